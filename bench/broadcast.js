@@ -0,0 +1,231 @@
+/**
+Copyright 2017 LGS Innovations
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+**/
+
+/**
+ * Broadcast benchmark for the bits-ipc bridge.
+ *
+ * Loads index.js against a stub BITS message center, connects N local
+ * IPC clients (in a child process) that all subscribe to one event, then
+ * publishes that event at a fixed rate and reports the bridge's CPU cost.
+ *
+ *   node bench/broadcast.js [--rate 10000] [--duration 3] [--clients 1,10,50,100,200]
+ */
+(() => {
+  'use strict';
+
+  const childProcess = require('child_process');
+  const net = require('net');
+
+  const EVENT = 'bench#tick';
+
+  function option(name, fallback) {
+    const index = process.argv.indexOf('--' + name);
+    return index >= 0 ? process.argv[index + 1] : fallback;
+  }
+
+  function frame(data) {
+    return JSON.stringify({type: 'bits-ipc', data: data}) + '\f';
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // Child process: N subscribed IPC clients counting what they receive
+
+  function runClients(socketPath, count) {
+    let received = 0;
+    let bytes = 0;
+    let connected = 0;
+
+    for (let i = 0; i < count; i++) {
+      const socket = net.connect(socketPath, () => {
+        socket.write(frame({type: 'addEventListener', event: EVENT, params: [{scopes: null}]}));
+        if (++connected === count) {
+          // give the bridge a moment to process the subscriptions
+          setTimeout(() => process.send({type: 'ready'}), 200);
+        }
+      });
+      socket.on('data', (data) => {
+        bytes += data.length;
+        for (let j = 0; j < data.length; j++) {
+          if (data[j] === 0x0c) {
+            received++;
+          }
+        }
+      });
+    }
+
+    process.on('message', (msg) => {
+      if (msg.type === 'report') {
+        process.send({type: 'report', received: received, bytes: bytes});
+      }
+    });
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // Parent process: the bridge under test
+
+  function stubBits() {
+    const logger = {
+      debug() {}, info() {},
+      warn: console.warn.bind(console),
+      error: console.error.bind(console)
+    };
+
+    class Messenger {
+      addEventListener() {}
+      addRequestListener() {}
+      load() { return Promise.resolve(); }
+      unload() { return Promise.resolve(); }
+    }
+
+    global.helper = {
+      LoggerFactory: { getLogger: () => logger },
+      Messenger: Messenger
+    };
+  }
+
+  class StubMessageCenter {
+    constructor() {
+      this._listeners = new Map();
+    }
+
+    addEventListener(event, scope, listener) {
+      if (!this._listeners.has(event)) {
+        this._listeners.set(event, []);
+      }
+      this._listeners.get(event).push(listener);
+      return Promise.resolve();
+    }
+
+    removeEventListener(event, listener) {
+      const listeners = this._listeners.get(event) || [];
+      const index = listeners.indexOf(listener);
+      if (index >= 0) {
+        listeners.splice(index, 1);
+      }
+      return Promise.resolve();
+    }
+
+    addRequestListener() { return Promise.resolve(); }
+    removeRequestListener() { return Promise.resolve(); }
+
+    sendEvent(event, scope, ...data) {
+      for (const listener of (this._listeners.get(event) || [])) {
+        listener(...data);
+      }
+      return Promise.resolve();
+    }
+
+    sendRequest(event) {
+      if (event === 'base#System bitsId') {
+        return Promise.resolve('bench-' + process.pid);
+      }
+      return Promise.resolve(null);
+    }
+  }
+
+  function request(child, type) {
+    return new Promise((resolve) => {
+      child.once('message', resolve);
+      child.send({type: type});
+    });
+  }
+
+  /**
+   * Publish EVENT at 'rate' per second for 'duration' ms, pacing on the
+   * high resolution clock so 1 ms timer granularity does not cap the rate
+   */
+  function publish(messageCenter, rate, duration) {
+    return new Promise((resolve) => {
+      const start = process.hrtime();
+      let sent = 0;
+
+      const tick = () => {
+        const elapsed = process.hrtime(start);
+        const elapsedMs = elapsed[0] * 1e3 + elapsed[1] / 1e6;
+        const due = Math.min(Math.floor(elapsedMs * rate / 1000), Math.floor(duration * rate / 1000));
+        while (sent < due) {
+          messageCenter.sendEvent(EVENT, {scopes: null}, sent, Date.now(), 'status-ok', 42.5);
+          sent++;
+        }
+        if (elapsedMs < duration) {
+          setTimeout(tick, 1);
+        } else {
+          resolve(sent);
+        }
+      };
+      tick();
+    });
+  }
+
+  function runBridge() {
+    stubBits();
+    const ipc = require('node-ipc');
+    ipc.config.silent = true;
+
+    const rate = Number(option('rate', 10000));
+    const duration = Number(option('duration', 3)) * 1000;
+    const counts = option('clients', '1,10,50,100,200').split(',').map(Number);
+
+    const bridge = require('../index.js');
+    const messageCenter = new StubMessageCenter();
+
+    return bridge.load(messageCenter)
+    .then(() => messageCenter.sendRequest('base#System bitsId'))
+    .then((systemId) => {
+      const socketPath = ipc.config.socketRoot + 'bits.' + systemId;
+      console.log('clients,rate_hz,events,delivered,bridge_cpu_ms,cpu_us_per_event,cpu_us_per_delivery');
+
+      return counts.reduce((chain, count) => chain.then(() => {
+        const child = childProcess.fork(__filename, ['clients', socketPath, String(count)]);
+        return new Promise((resolve) => child.once('message', resolve))
+        .then(() => {
+          const cpuStart = process.cpuUsage();
+          return publish(messageCenter, rate, duration)
+          .then((sent) => {
+            const cpu = process.cpuUsage(cpuStart);
+            // let the sockets drain before asking for the count
+            return new Promise((resolve) => setTimeout(resolve, 500))
+            .then(() => request(child, 'report'))
+            .then((report) => {
+              const cpuUs = cpu.user + cpu.system;
+              console.log([
+                count,
+                rate,
+                sent,
+                report.received,
+                (cpuUs / 1000).toFixed(1),
+                (cpuUs / sent).toFixed(2),
+                (cpuUs / Math.max(report.received, 1)).toFixed(3)
+              ].join(','));
+              child.kill();
+            });
+          });
+        });
+      }), Promise.resolve());
+    })
+    .then(() => process.exit(0))
+    .catch((err) => {
+      console.error(err);
+      process.exit(1);
+    });
+  }
+
+  if (process.argv[2] === 'clients') {
+    runClients(process.argv[3], Number(process.argv[4]));
+  } else {
+    runBridge();
+  }
+})();
@@ -0,0 +1,238 @@
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+namespace bits {
+
+/*
+ * Capture files hold every frame a MessageCenter sent and received, for
+ * replaying production traffic through the parser and dispatch path
+ * (see replay.cc). Layout, native byte order:
+ *
+ *   "BITSCAP1"
+ *   per frame: uint64 nanoseconds (steady clock), uint32 length,
+ *              uint8 direction ('i' received, 'o' sent,
+ *              'x' failed to send), 3 bytes zero,
+ *              length bytes of frame without the delimiter
+ *
+ * A direction of 0 ends the file, so a capture cut short by a crash,
+ * where the mapped file is still zero-filled past the last frame, reads
+ * back up to the last complete frame.
+ */
+struct CaptureRecord {
+    uint64_t timeNs;
+    char direction;
+    const char *data;
+    uint32_t length;
+};
+
+class CaptureWriter {
+    public:
+        CaptureWriter() : _fd(-1), _map(nullptr), _size(0), _offset(0), _open(false) {}
+
+        ~CaptureWriter() {
+            close();
+        }
+
+        /**
+         * Start a new capture file at path, replacing any existing one
+         */
+        bool open(const std::string &path) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _close();
+
+            _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (_fd < 0 || !_remap(INITIAL_SIZE)) {
+                _close();
+                return false;
+            }
+            memcpy(_map, "BITSCAP1", 8);
+            _offset = 8;
+            _open = true;
+            return true;
+        }
+
+        /**
+         * Trim the file to the frames written and close it
+         */
+        void close() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _close();
+        }
+
+        bool isOpen() const {
+            return _open.load(std::memory_order_relaxed);
+        }
+
+        void append(char direction, uint64_t timeNs, const char *data, size_t length) {
+            if (!isOpen()) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_fd < 0) {
+                return;
+            }
+            const size_t needed = _offset + HEADER_SIZE + length;
+            if (needed > _size && !_remap(_grow(needed))) {
+                _close();
+                return;
+            }
+
+            char *out = _map + _offset;
+            const uint32_t length32 = static_cast<uint32_t>(length);
+            memcpy(out, &timeNs, 8);
+            memcpy(out + 8, &length32, 4);
+            memcpy(out + 16, data, length);
+            // the direction goes in last, it marks the frame complete
+            out[12] = direction;
+            _offset = needed;
+        }
+
+    private:
+        static const size_t HEADER_SIZE = 16;
+        static const size_t INITIAL_SIZE = 16 << 20;
+
+        std::mutex _mutex;
+        int _fd;
+        char *_map;
+        size_t _size;
+        size_t _offset;
+        std::atomic<bool> _open;
+
+        static size_t _grow(size_t needed) {
+            size_t size = INITIAL_SIZE;
+            while (size < needed) {
+                size *= 2;
+            }
+            return size;
+        }
+
+        /**
+         * Extend the file to size and map all of it
+         */
+        bool _remap(size_t size) {
+            if (_map != nullptr) {
+                munmap(_map, _size);
+                _map = nullptr;
+            }
+            if (ftruncate(_fd, size) != 0) {
+                return false;
+            }
+            void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+            if (map == MAP_FAILED) {
+                return false;
+            }
+            _map = static_cast<char*>(map);
+            _size = size;
+            return true;
+        }
+
+        void _close() {
+            _open = false;
+            if (_map != nullptr) {
+                munmap(_map, _size);
+                _map = nullptr;
+            }
+            if (_fd >= 0) {
+                if (ftruncate(_fd, _offset) != 0) {
+                    // the zero-filled tail still reads as end of capture
+                }
+                ::close(_fd);
+                _fd = -1;
+            }
+            _size = 0;
+            _offset = 0;
+        }
+
+        CaptureWriter(const CaptureWriter &);
+        CaptureWriter &operator=(const CaptureWriter &);
+};
+
+/*
+ * Maps a capture file read-only and walks its frames
+ */
+class CaptureReader {
+    public:
+        CaptureReader() : _map(nullptr), _size(0), _offset(0) {}
+
+        ~CaptureReader() {
+            _unmap();
+        }
+
+        bool open(const std::string &path) {
+            _unmap();
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            void *map = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= 8) {
+                map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            ::close(fd);
+            if (map == MAP_FAILED) {
+                return false;
+            }
+            _map = static_cast<const char*>(map);
+            _size = st.st_size;
+            if (memcmp(_map, "BITSCAP1", 8) != 0) {
+                return false;
+            }
+            rewind();
+            return true;
+        }
+
+        void rewind() {
+            _offset = 8;
+        }
+
+        /**
+         * The next frame, pointing into the mapping; false at the end
+         */
+        bool next(CaptureRecord &record) {
+            if (_offset + 16 > _size || _map[_offset + 12] == 0) {
+                return false;
+            }
+            uint32_t length;
+            memcpy(&record.timeNs, _map + _offset, 8);
+            memcpy(&length, _map + _offset + 8, 4);
+            if (_offset + 16 + length > _size) {
+                return false;
+            }
+            record.direction = _map[_offset + 12];
+            record.data = _map + _offset + 16;
+            record.length = length;
+            _offset += 16 + length;
+            return true;
+        }
+
+    private:
+        const char *_map;
+        size_t _size;
+        size_t _offset;
+
+        void _unmap() {
+            if (_map != nullptr) {
+                munmap(const_cast<char*>(_map), _size);
+                _map = nullptr;
+            }
+        }
+
+        CaptureReader(const CaptureReader &);
+        CaptureReader &operator=(const CaptureReader &);
+};
+
+} // namespace bits
+
+#endif
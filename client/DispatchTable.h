@@ -0,0 +1,232 @@
+#ifndef DISPATCH_TABLE_H
+#define DISPATCH_TABLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace bits {
+
+/*
+ * Small integer handle for an interned event or request name. Ids are
+ * handed out in registration order and never reused.
+ */
+typedef uint32_t InternedId;
+
+/*
+ * Returned by lookups for names that were never interned
+ */
+const InternedId INVALID_ID = 0xffffffff;
+
+/*
+ * Minimal perfect hash over a fixed key set (hash-and-displace). Keys are
+ * bucketed by one hash, and every bucket stores the displacement that
+ * lands all of its keys in distinct slots. A lookup hashes the name once
+ * and verifies the single candidate slot with one compare.
+ */
+class PerfectHashIndex {
+    public:
+        /**
+         * Rebuild the table so that keys[i] maps to id i
+         */
+        void build(const std::vector<std::string> &keys) {
+            _keys = keys;
+            _mask = 0;
+            _displacements.clear();
+            _slots.clear();
+
+            if (_keys.empty()) {
+                return;
+            }
+
+            size_t size = 1;
+            while (size < _keys.size()) {
+                size <<= 1;
+            }
+
+            while (!_tryBuild(size)) {
+                size <<= 1;
+            }
+        }
+
+        InternedId find(const char *key, size_t len) const {
+            if (_slots.empty()) {
+                return INVALID_ID;
+            }
+
+            const uint64_t h = _hash(key, len);
+            const int32_t d = _displacements[_slot(h, 0, _mask)];
+            const size_t slot = d < 0 ? static_cast<size_t>(-d - 1) : _slot(h, d, _mask);
+            const InternedId id = _slots[slot];
+
+            if (id == INVALID_ID || _keys[id].size() != len ||
+                memcmp(_keys[id].data(), key, len) != 0) {
+                return INVALID_ID;
+            }
+            return id;
+        }
+
+        InternedId find(const std::string &key) const {
+            return find(key.data(), key.size());
+        }
+
+        const std::vector<std::string> &keys() const {
+            return _keys;
+        }
+
+    private:
+        // give up on a table size after this many displacements per bucket
+        static const uint32_t MAX_DISPLACEMENT = 1 << 16;
+
+        std::vector<std::string> _keys;
+        std::vector<int32_t> _displacements;
+        std::vector<InternedId> _slots;
+        size_t _mask = 0;
+
+        /**
+         * FNV-1a over the key bytes
+         */
+        static uint64_t _hash(const char *key, size_t len) {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (size_t i = 0; i < len; ++i) {
+                h ^= static_cast<unsigned char>(key[i]);
+                h *= 0x100000001b3ULL;
+            }
+            return h;
+        }
+
+        /**
+         * Derive the slot for displacement d from the key hash (splitmix64
+         * finalizer), so the key bytes are only walked once per lookup
+         */
+        static size_t _slot(uint64_t h, uint32_t d, size_t mask) {
+            uint64_t z = h + (static_cast<uint64_t>(d) + 1) * 0x9e3779b97f4a7c15ULL;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return static_cast<size_t>(z ^ (z >> 31)) & mask;
+        }
+
+        bool _tryBuild(size_t size) {
+            _mask = size - 1;
+            _displacements.assign(size, 0);
+            _slots.assign(size, INVALID_ID);
+
+            std::vector<uint64_t> hashes;
+            std::vector< std::vector<InternedId> > buckets(size);
+            for (InternedId id = 0; id < _keys.size(); ++id) {
+                hashes.push_back(_hash(_keys[id].data(), _keys[id].size()));
+                buckets[_slot(hashes[id], 0, _mask)].push_back(id);
+            }
+
+            // Place the most crowded buckets first while the table is empty
+            std::vector<size_t> order;
+            for (size_t b = 0; b < size; ++b) {
+                if (!buckets[b].empty()) {
+                    order.push_back(b);
+                }
+            }
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return buckets[a].size() > buckets[b].size();
+            });
+
+            size_t nextFree = 0;
+            std::vector<size_t> placed;
+            for (size_t b : order) {
+                const std::vector<InternedId> &bucket = buckets[b];
+
+                if (bucket.size() == 1) {
+                    // Singletons go straight into a free slot
+                    while (_slots[nextFree] != INVALID_ID) {
+                        ++nextFree;
+                    }
+                    _slots[nextFree] = bucket[0];
+                    _displacements[b] = -static_cast<int32_t>(nextFree) - 1;
+                    continue;
+                }
+
+                uint32_t d = 1;
+                for (; d < MAX_DISPLACEMENT; ++d) {
+                    placed.clear();
+                    for (InternedId id : bucket) {
+                        size_t slot = _slot(hashes[id], d, _mask);
+                        if (_slots[slot] != INVALID_ID ||
+                            std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+                            break;
+                        }
+                        placed.push_back(slot);
+                    }
+                    if (placed.size() == bucket.size()) {
+                        break;
+                    }
+                }
+                if (d == MAX_DISPLACEMENT) {
+                    return false;
+                }
+
+                for (size_t i = 0; i < bucket.size(); ++i) {
+                    _slots[placed[i]] = bucket[i];
+                }
+                _displacements[b] = static_cast<int32_t>(d);
+            }
+
+            return true;
+        }
+};
+
+/*
+ * Values of type V keyed by interned name. Registration interns the name
+ * and rebuilds the perfect hash when a new name appears; the dispatch path
+ * only calls find() and at().
+ */
+template<typename V>
+class DispatchTable {
+    public:
+        /**
+         * Return the id for name, assigning the next one if it is new
+         */
+        InternedId intern(const std::string &name) {
+            InternedId id = _index.find(name);
+            if (id == INVALID_ID) {
+                std::vector<std::string> keys = _index.keys();
+                id = static_cast<InternedId>(keys.size());
+                keys.push_back(name);
+                _index.build(keys);
+                _values.push_back(V());
+            }
+            return id;
+        }
+
+        InternedId find(const char *name, size_t len) const {
+            return _index.find(name, len);
+        }
+
+        InternedId find(const std::string &name) const {
+            return _index.find(name);
+        }
+
+        V &at(InternedId id) {
+            return _values[id];
+        }
+
+        const V &at(InternedId id) const {
+            return _values[id];
+        }
+
+        const std::string &name(InternedId id) const {
+            return _index.keys()[id];
+        }
+
+        size_t size() const {
+            return _values.size();
+        }
+
+    private:
+        PerfectHashIndex _index;
+        std::vector<V> _values;
+};
+
+} // namespace bits
+
+#endif
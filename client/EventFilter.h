@@ -0,0 +1,196 @@
+#ifndef EVENT_FILTER_H
+#define EVENT_FILTER_H
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+namespace bits {
+
+/*
+ * Declarative predicate over event params, pushed down to the bridge with
+ * a subscription so events that fail it are never serialized or sent (see
+ * lib/event-filter.js for the wire format). Clauses are ANDed:
+ *
+ *   bits::EventFilter::eq("0.sensorId", 7) &
+ *   bits::EventFilter::range("1", 10.0, 20.0) &
+ *   bits::EventFilter::sample(10)
+ *
+ * Paths are dot separated and rooted at the params array; numeric
+ * segments index arrays.
+ */
+class EventFilter {
+    public:
+        typedef nlohmann::json json;
+
+        static EventFilter eq(const std::string &path, const json &value) {
+            return _clause(path, "eq", value);
+        }
+
+        static EventFilter oneOf(const std::string &path, const std::vector<json> &values) {
+            return _clause(path, "in", json(values));
+        }
+
+        /**
+         * min <= value < max
+         */
+        static EventFilter range(const std::string &path, double min, double max) {
+            EventFilter filter = _clause(path, "gte", min);
+            filter._clauses[0]["lt"] = max;
+            return filter;
+        }
+
+        static EventFilter atLeast(const std::string &path, double min) {
+            return _clause(path, "gte", min);
+        }
+
+        static EventFilter below(const std::string &path, double max) {
+            return _clause(path, "lt", max);
+        }
+
+        /**
+         * Pass every n-th event that matched the clauses before this one,
+         * starting with the first. The bridge samples, once per distinct
+         * filter on a connection, and tags the frames each sampled filter
+         * accepted so the client does not sample again.
+         */
+        static EventFilter sample(unsigned int every) {
+            EventFilter filter;
+            filter._clauses.push_back({{"sample", every}});
+            return filter;
+        }
+
+        EventFilter &operator&=(const EventFilter &other) {
+            _clauses.insert(_clauses.end(), other._clauses.begin(), other._clauses.end());
+            return *this;
+        }
+
+        bool empty() const {
+            return _clauses.empty();
+        }
+
+        /**
+         * Whether a sample clause makes the filter stateful
+         */
+        bool sampled() const {
+            for (const json &clause : _clauses) {
+                if (clause.count("sample") > 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * The "filter" member of the subscription options, null if empty
+         */
+        json toJson() const {
+            if (_clauses.empty()) {
+                return json();
+            }
+            return {{"all", _clauses}};
+        }
+
+        /**
+         * Evaluate the field clauses against params. Sampling is done by
+         * the bridge only, so sample clauses always pass here.
+         */
+        bool matches(const json &params) const {
+            for (const json &clause : _clauses) {
+                if (clause.count("path") == 0) {
+                    continue;
+                }
+                const json *value = _resolve(params, clause["path"].get_ref<const std::string&>());
+                if (!_test(clause, value)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        std::vector<json> _clauses;
+
+        static EventFilter _clause(const std::string &path, const char *op, const json &value) {
+            EventFilter filter;
+            filter._clauses.push_back({{"path", path}, {op, value}});
+            return filter;
+        }
+
+        static const json *_resolve(const json &params, const std::string &path) {
+            const json *value = &params;
+            size_t start = 0;
+            while (start <= path.size()) {
+                size_t end = path.find('.', start);
+                if (end == std::string::npos) {
+                    end = path.size();
+                }
+                const std::string segment = path.substr(start, end - start);
+                if (value->is_array()) {
+                    char *rest = nullptr;
+                    unsigned long index = strtoul(segment.c_str(), &rest, 10);
+                    if (segment.empty() || *rest != '\0' || index >= value->size()) {
+                        return nullptr;
+                    }
+                    value = &(*value)[index];
+                } else if (value->is_object()) {
+                    auto it = value->find(segment);
+                    if (it == value->end()) {
+                        return nullptr;
+                    }
+                    value = &*it;
+                } else {
+                    return nullptr;
+                }
+                start = end + 1;
+            }
+            return value;
+        }
+
+        static bool _test(const json &clause, const json *value) {
+            for (auto it = clause.begin(); it != clause.end(); ++it) {
+                const std::string &op = it.key();
+                if (op == "path") {
+                    continue;
+                }
+                if (value == nullptr) {
+                    return false;
+                }
+                if (op == "eq") {
+                    if (*value != it.value()) {
+                        return false;
+                    }
+                } else if (op == "in") {
+                    bool found = false;
+                    for (const json &candidate : it.value()) {
+                        found = found || *value == candidate;
+                    }
+                    if (!found) {
+                        return false;
+                    }
+                } else {
+                    if (!value->is_number()) {
+                        return false;
+                    }
+                    double x = value->get<double>();
+                    double bound = it.value().get<double>();
+                    if ((op == "gt" && !(x > bound)) || (op == "gte" && !(x >= bound)) ||
+                        (op == "lt" && !(x < bound)) || (op == "lte" && !(x <= bound))) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+};
+
+inline EventFilter operator&(EventFilter a, const EventFilter &b) {
+    a &= b;
+    return a;
+}
+
+} // namespace bits
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bits {
+
+/*
+ * Fixed-size ring of the most recent frames that crossed the socket:
+ * direction, wall clock time, full length and the first PAYLOAD_BYTES
+ * bytes. All memory is allocated up front and record() is lock-free (one
+ * fetch_add to claim a slot, a memcpy and two stores), so it can stay on
+ * at full event rate. Each slot is a seqlock: readers copy it and keep
+ * the copy only if its sequence did not change meanwhile, so a frame
+ * being overwritten is skipped rather than dumped half-written.
+ *
+ * dump() only uses write(2) and stack buffers, so it may be called from
+ * a signal handler; see dumpOnSignal().
+ */
+class FlightRecorder {
+    public:
+        static const size_t PAYLOAD_BYTES = 240;
+
+        enum Direction {
+            Incoming = 'i',
+            Outgoing = 'o',
+            // a frame whose write to the socket failed
+            Failed = 'x'
+        };
+
+        struct Entry {
+            uint64_t sequence;
+            char direction;
+            // nanoseconds since the epoch
+            uint64_t timeNs;
+            // length of the whole frame; payload holds at most PAYLOAD_BYTES
+            uint32_t bytes;
+            std::string payload;
+        };
+
+        /**
+         * Keep the last slots frames, rounded up to a power of two
+         */
+        explicit FlightRecorder(size_t slots=1024) :
+            _mask(_capacity(slots) - 1),
+            _slots(new Slot[_mask + 1]),
+            _next(0),
+            _enabled(true) {}
+
+        ~FlightRecorder() {
+            FlightRecorder *self = this;
+            _signalTarget().compare_exchange_strong(self, nullptr);
+        }
+
+        void setEnabled(bool enabled) {
+            _enabled.store(enabled, std::memory_order_relaxed);
+        }
+
+        size_t capacity() const {
+            return _mask + 1;
+        }
+
+        void record(Direction direction, const char *data, size_t size) {
+            if (!_enabled.load(std::memory_order_relaxed)) {
+                return;
+            }
+            const uint64_t sequence = _next.fetch_add(1, std::memory_order_relaxed);
+            Slot &slot = _slots[sequence & _mask];
+
+            // odd while writing, 2 * (sequence + 1) once complete
+            slot.version.store(2 * sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.direction = static_cast<char>(direction);
+            slot.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            slot.bytes = static_cast<uint32_t>(size);
+            if (size > PAYLOAD_BYTES) {
+                size = PAYLOAD_BYTES;
+            }
+            slot.length = static_cast<uint32_t>(size);
+            memcpy(slot.payload, data, size);
+            slot.version.store(2 * sequence + 2, std::memory_order_release);
+        }
+
+        /**
+         * The recorded frames, oldest first
+         */
+        std::vector<Entry> entries() const {
+            std::vector<Entry> result;
+            Slot copy;
+            const uint64_t end = _next.load(std::memory_order_acquire);
+            for (uint64_t sequence = _first(end); sequence < end; ++sequence) {
+                if (_read(sequence, copy)) {
+                    Entry entry = {
+                        sequence, copy.direction, copy.timeNs, copy.bytes,
+                        std::string(copy.payload, copy.length)
+                    };
+                    result.push_back(entry);
+                }
+            }
+            return result;
+        }
+
+        /**
+         * Write the recorded frames, oldest first, one per line:
+         *   <sequence> <i|o> <seconds.nanoseconds> <bytes> <payload>
+         * Async-signal-safe.
+         */
+        void dump(int fd) const {
+            Slot copy;
+            char line[PAYLOAD_BYTES + 96];
+            const uint64_t end = _next.load(std::memory_order_acquire);
+            for (uint64_t sequence = _first(end); sequence < end; ++sequence) {
+                if (!_read(sequence, copy)) {
+                    continue;
+                }
+                size_t n = 0;
+                n = _appendNumber(line, n, sequence);
+                line[n++] = ' ';
+                line[n++] = copy.direction;
+                line[n++] = ' ';
+                n = _appendNumber(line, n, copy.timeNs / 1000000000);
+                line[n++] = '.';
+                n = _appendNumber(line, n, copy.timeNs % 1000000000, 9);
+                line[n++] = ' ';
+                n = _appendNumber(line, n, copy.bytes);
+                line[n++] = ' ';
+                for (uint32_t i = 0; i < copy.length; ++i) {
+                    const unsigned char c = copy.payload[i];
+                    line[n++] = c < 0x20 || c == 0x7f ? '.' : c;
+                }
+                if (copy.length < copy.bytes) {
+                    memcpy(line + n, "...", 3);
+                    n += 3;
+                }
+                line[n++] = '\n';
+                _writeAll(fd, line, n);
+            }
+        }
+
+        /**
+         * Dump this recorder to fd whenever signum is raised. One
+         * recorder per process can be the target; the latest call wins.
+         */
+        bool dumpOnSignal(int signum, int fd=STDERR_FILENO) {
+            _signalFd().store(fd);
+            _signalTarget().store(this);
+
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = &FlightRecorder::_onSignal;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            return sigaction(signum, &action, nullptr) == 0;
+        }
+
+    private:
+        struct Slot {
+            std::atomic<uint64_t> version;
+            char direction;
+            uint64_t timeNs;
+            uint32_t bytes;
+            uint32_t length;
+            char payload[PAYLOAD_BYTES];
+
+            Slot() : version(0) {}
+        };
+
+        const uint64_t _mask;
+        std::unique_ptr<Slot[]> _slots;
+        std::atomic<uint64_t> _next;
+        std::atomic<bool> _enabled;
+
+        static size_t _capacity(size_t slots) {
+            size_t capacity = 1;
+            while (capacity < slots) {
+                capacity <<= 1;
+            }
+            return capacity;
+        }
+
+        uint64_t _first(uint64_t end) const {
+            return end > _mask + 1 ? end - (_mask + 1) : 0;
+        }
+
+        /**
+         * Copy the slot holding sequence; false if it is being written or
+         * was already overwritten by a later frame
+         */
+        bool _read(uint64_t sequence, Slot &copy) const {
+            const Slot &slot = _slots[sequence & _mask];
+            const uint64_t version = slot.version.load(std::memory_order_acquire);
+            if (version != 2 * sequence + 2) {
+                return false;
+            }
+            copy.direction = slot.direction;
+            copy.timeNs = slot.timeNs;
+            copy.bytes = slot.bytes;
+            copy.length = slot.length;
+            if (copy.length > PAYLOAD_BYTES) {
+                copy.length = PAYLOAD_BYTES;
+            }
+            memcpy(copy.payload, slot.payload, copy.length);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return slot.version.load(std::memory_order_relaxed) == version;
+        }
+
+        static size_t _appendNumber(char *out, size_t n, uint64_t value, int width=0) {
+            char digits[20];
+            int count = 0;
+            do {
+                digits[count++] = '0' + value % 10;
+                value /= 10;
+            } while (value > 0);
+            while (count < width) {
+                digits[count++] = '0';
+            }
+            while (count > 0) {
+                out[n++] = digits[--count];
+            }
+            return n;
+        }
+
+        static void _writeAll(int fd, const char *data, size_t size) {
+            while (size > 0) {
+                ssize_t rc = write(fd, data, size);
+                if (rc < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (rc <= 0) {
+                    return;
+                }
+                data += rc;
+                size -= rc;
+            }
+        }
+
+        // constant-initialized, so safe to touch from the signal handler
+        static std::atomic<FlightRecorder*> &_signalTarget() {
+            static std::atomic<FlightRecorder*> target(nullptr);
+            return target;
+        }
+
+        static std::atomic<int> &_signalFd() {
+            static std::atomic<int> fd(STDERR_FILENO);
+            return fd;
+        }
+
+        static void _onSignal(int) {
+            const int savedErrno = errno;
+            FlightRecorder *recorder = _signalTarget().load();
+            if (recorder) {
+                recorder->dump(_signalFd().load());
+            }
+            errno = savedErrno;
+        }
+
+        FlightRecorder(const FlightRecorder &);
+        FlightRecorder &operator=(const FlightRecorder &);
+};
+
+} // namespace bits
+
+#endif
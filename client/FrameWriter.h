@@ -0,0 +1,255 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+#include "json.hpp"
+
+namespace bits {
+
+/*
+ * Appends bits-ipc frames to a string as JSON text without building a
+ * json DOM first. Values are formatted the same way json::dump() would
+ * format them so both paths produce interchangeable frames.
+ */
+class FrameWriter {
+    public:
+        explicit FrameWriter(std::string &out) : _out(out) {}
+
+        /**
+         * Open the bits-ipc envelope up to and including the '[' of the
+         * params array, e.g. {"type":"bits-ipc","data":{"type":"event",...
+         */
+        void beginFrame(const char *type, const std::string &event) {
+            _out.append("{\"type\":\"bits-ipc\",\"data\":{\"type\":\"");
+            _out.append(type);
+            _out.append("\",\"event\":");
+            value(event);
+        }
+
+        /**
+         * Add a "requestId" / "responseId" member to the open frame
+         */
+        template<typename T>
+        void member(const char *key, const T &val) {
+            _out.append(",\"");
+            _out.append(key);
+            _out.append("\":");
+            value(val);
+        }
+
+        void beginParams() {
+            _out.append(",\"params\":[");
+            _first = true;
+        }
+
+        /**
+         * Write the leading scope object the bridge expects in params[0]
+         * of events and requests: {"scope":null} or {"scopes":[...]}.
+         */
+        void scope(const std::vector<std::string> &scopes) {
+            _separator();
+            if (scopes.size() == 0) {
+                _out.append("{\"scope\":null}");
+            } else {
+                _out.append("{\"scopes\":[");
+                for (size_t i = 0; i < scopes.size(); ++i) {
+                    if (i > 0) {
+                        _out.push_back(',');
+                    }
+                    value(scopes[i]);
+                }
+                _out.append("]}");
+            }
+        }
+
+        template<typename T>
+        void param(const T &t) {
+            _separator();
+            value(t);
+        }
+
+        void endFrame() {
+            _out.append("]}}");
+        }
+
+        /**
+         * Close the params and add a latency "stamps" member holding the
+         * one stamp [hop, "ns"], without building a json first
+         */
+        void endFrame(const char *hop, uint64_t ns) {
+            _out.append("],\"stamps\":[[");
+            value(hop);
+            _out.append(",\"");
+            value(ns);
+            _out.append("\"]]}}");
+        }
+
+        /**
+         * Close the params and add the latency "stamps" member before
+         * closing the frame
+         */
+        void endFrame(const nlohmann::json &stamps) {
+            _out.append("],\"stamps\":");
+            value(stamps);
+            _out.append("}}");
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // Scalar values
+
+        void value(std::nullptr_t) {
+            _out.append("null");
+        }
+
+        void value(bool b) {
+            _out.append(b ? "true" : "false");
+        }
+
+        void value(const char *s) {
+            _out.push_back('"');
+            _escape(s, strlen(s));
+            _out.push_back('"');
+        }
+
+        void value(const std::string &s) {
+            _out.push_back('"');
+            _escape(s.data(), s.size());
+            _out.push_back('"');
+        }
+
+        void value(const nlohmann::json &j) {
+            // scalars directly, dump() would build a temporary string
+            switch (j.type()) {
+                case nlohmann::json::value_t::null:
+                    value(nullptr);
+                    break;
+                case nlohmann::json::value_t::boolean:
+                    value(j.get<bool>());
+                    break;
+                case nlohmann::json::value_t::string:
+                    value(j.get_ref<const std::string&>());
+                    break;
+                case nlohmann::json::value_t::number_integer:
+                    value(j.get<int64_t>());
+                    break;
+                case nlohmann::json::value_t::number_unsigned:
+                    value(j.get<uint64_t>());
+                    break;
+                case nlohmann::json::value_t::number_float:
+                    value(j.get<double>());
+                    break;
+                default:
+                    _out.append(j.dump());
+                    break;
+            }
+        }
+
+        template<typename T>
+        typename std::enable_if<
+            std::is_integral<T>::value && !std::is_same<T, bool>::value
+        >::type value(T x) {
+            char buf[24];
+            size_t i = 0;
+            bool negative = x < 0;
+            // Work in unsigned so the most negative value does not overflow
+            uint64_t u = negative ? 0 - static_cast<uint64_t>(x) : static_cast<uint64_t>(x);
+            do {
+                buf[i++] = static_cast<char>('0' + (u % 10));
+                u /= 10;
+            } while (u != 0);
+            if (negative) {
+                buf[i++] = '-';
+            }
+            while (i > 0) {
+                _out.push_back(buf[--i]);
+            }
+        }
+
+        template<typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type value(T x) {
+            if (!std::isfinite(x)) {
+                _out.append("null");
+                return;
+            }
+            if (x == 0) {
+                _out.append(std::signbit(x) ? "-0.0" : "0.0");
+                return;
+            }
+
+            // json stores every float as a double, so format the double
+            // a float converts to rather than the shorter float digits
+            char buf[64];
+            int n = snprintf(buf, sizeof(buf), "%.*g",
+                             std::numeric_limits<double>::digits10, static_cast<double>(x));
+            bool intLike = true;
+            for (int i = 0; i < n; ++i) {
+                if (buf[i] == ',') {
+                    buf[i] = '.';
+                }
+                intLike = intLike && buf[i] != '.' && buf[i] != 'e' && buf[i] != 'E';
+            }
+            _out.append(buf, n);
+            if (intLike) {
+                _out.append(".0");
+            }
+        }
+
+        /**
+         * Anything else goes through the json type conversions
+         */
+        template<typename T>
+        typename std::enable_if<
+            !std::is_arithmetic<T>::value &&
+            !std::is_convertible<const T&, std::string>::value &&
+            !std::is_same<T, nlohmann::json>::value
+        >::type value(const T &t) {
+            value(nlohmann::json(t));
+        }
+
+    private:
+        std::string &_out;
+        bool _first = true;
+
+        void _separator() {
+            if (!_first) {
+                _out.push_back(',');
+            }
+            _first = false;
+        }
+
+        void _escape(const char *s, size_t n) {
+            static const char hexify[] = "0123456789abcdef";
+            for (size_t i = 0; i < n; ++i) {
+                const char c = s[i];
+                switch (c) {
+                    case '"':  _out.append("\\\""); break;
+                    case '\\': _out.append("\\\\"); break;
+                    case '\b': _out.append("\\b"); break;
+                    case '\f': _out.append("\\f"); break;
+                    case '\n': _out.append("\\n"); break;
+                    case '\r': _out.append("\\r"); break;
+                    case '\t': _out.append("\\t"); break;
+                    default:
+                        if (c >= 0x00 && c <= 0x1f) {
+                            _out.append("\\u00");
+                            _out.push_back(hexify[c >> 4]);
+                            _out.push_back(hexify[c & 0x0f]);
+                        } else {
+                            _out.push_back(c);
+                        }
+                }
+            }
+        }
+};
+
+} // namespace bits
+
+#endif
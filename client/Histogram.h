@@ -0,0 +1,165 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace bits {
+
+/*
+ * Summary of a Histogram at one point in time, values in nanoseconds
+ */
+struct HistogramSnapshot {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+};
+
+/*
+ * High dynamic range histogram of durations in nanoseconds. Buckets are
+ * log-linear: every power of two is split into 64 linear sub-buckets, so
+ * any value is kept to within 1/64 (about 1.6%) from 1ns to the clamp at
+ * 2^40ns (about 18 minutes). The bucket array is fixed, and record() is a
+ * few relaxed atomic adds, so it is lock-free and allocation-free and can
+ * be called from any thread.
+ */
+class Histogram {
+    public:
+        Histogram() {
+            reset();
+        }
+
+        void record(uint64_t value) {
+            if (value > MAX_VALUE) {
+                value = MAX_VALUE;
+            }
+            _counts[_index(value)].fetch_add(1, std::memory_order_relaxed);
+            _count.fetch_add(1, std::memory_order_relaxed);
+            _sum.fetch_add(value, std::memory_order_relaxed);
+
+            uint64_t seen = _max.load(std::memory_order_relaxed);
+            while (value > seen &&
+                   !_max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+            seen = _min.load(std::memory_order_relaxed);
+            while (value < seen &&
+                   !_min.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+        }
+
+        /**
+         * Summarize the recorded values; with reset, start a new interval.
+         * Values recorded while a reset snapshot is taken land in either
+         * interval, never in both.
+         */
+        HistogramSnapshot snapshot(bool reset=false) {
+            uint64_t counts[BUCKETS];
+            uint64_t total = 0;
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                counts[i] = reset ? _counts[i].exchange(0, std::memory_order_relaxed)
+                                  : _counts[i].load(std::memory_order_relaxed);
+                total += counts[i];
+            }
+
+            HistogramSnapshot snapshot = {};
+            uint64_t sum = reset ? _sum.exchange(0) : _sum.load();
+            uint64_t min = reset ? _min.exchange(MAX_VALUE) : _min.load();
+            uint64_t max = reset ? _max.exchange(0) : _max.load();
+            if (reset) {
+                _count.exchange(0);
+            }
+            if (total == 0) {
+                return snapshot;
+            }
+
+            snapshot.count = total;
+            snapshot.min = min;
+            snapshot.max = max;
+            snapshot.mean = static_cast<double>(sum) / total;
+            snapshot.p50 = _percentile(counts, total, 0.50, max);
+            snapshot.p90 = _percentile(counts, total, 0.90, max);
+            snapshot.p99 = _percentile(counts, total, 0.99, max);
+            snapshot.p999 = _percentile(counts, total, 0.999, max);
+            return snapshot;
+        }
+
+        void reset() {
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                _counts[i].store(0, std::memory_order_relaxed);
+            }
+            _count = 0;
+            _sum = 0;
+            _min = MAX_VALUE;
+            _max = 0;
+        }
+
+    private:
+        // sub-buckets per power of two are 2^(SUB_BITS - 1)
+        static const unsigned int SUB_BITS = 7;
+        static const uint64_t HALF = 1ULL << (SUB_BITS - 1);
+        static const uint64_t MAX_VALUE = (1ULL << 40) - 1;
+        static const size_t BUCKETS = (40 - SUB_BITS + 2) * HALF;
+
+        std::atomic<uint64_t> _counts[BUCKETS];
+        std::atomic<uint64_t> _count;
+        std::atomic<uint64_t> _sum;
+        std::atomic<uint64_t> _min;
+        std::atomic<uint64_t> _max;
+
+        static unsigned int _log2(uint64_t value) {
+            return 63 - __builtin_clzll(value);
+        }
+
+        /**
+         * Values below 2 * HALF map to themselves; above, the magnitude
+         * picks a block of HALF buckets and the top SUB_BITS bits of the
+         * value pick one inside it
+         */
+        static size_t _index(uint64_t value) {
+            if (value < 2 * HALF) {
+                return static_cast<size_t>(value);
+            }
+            unsigned int shift = _log2(value) - SUB_BITS + 1;
+            return static_cast<size_t>(shift * HALF + (value >> shift));
+        }
+
+        /**
+         * Midpoint of the values that map to bucket index
+         */
+        static uint64_t _value(size_t index) {
+            if (index < 2 * HALF) {
+                return index;
+            }
+            uint64_t shift = index / HALF - 1;
+            uint64_t sub = index - shift * HALF;
+            return (sub << shift) + ((1ULL << shift) >> 1);
+        }
+
+        static uint64_t _percentile(const uint64_t *counts, uint64_t total,
+                                    double q, uint64_t max) {
+            uint64_t rank = static_cast<uint64_t>(q * total + 0.5);
+            if (rank == 0) {
+                rank = 1;
+            }
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    uint64_t value = _value(i);
+                    return value < max ? value : max;
+                }
+            }
+            return max;
+        }
+
+        Histogram(const Histogram &);
+        Histogram &operator=(const Histogram &);
+};
+
+} // namespace bits
+
+#endif
@@ -1,22 +1,39 @@
 #ifndef MESSAGE_CENTER_H
 #define MESSAGE_CENTER_H
 
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <functional>
 #include <chrono>
 #include <unordered_map>
+#include <map>
 #include <thread>
 #include <utility>
+#include <tuple>
 #include <cstdlib>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 
 #include "json.hpp"
+#include "CaptureFile.h"
+#include "DispatchTable.h"
+#include "EventFilter.h"
+#include "FlightRecorder.h"
+#include "FrameWriter.h"
+#include "Histogram.h"
+#include "Probes.h"
+#include "RcuCell.h"
+#include "TypedMessages.h"
 
 using json = nlohmann::json;
 
@@ -46,6 +63,169 @@ class MessageCenter {
         typedef std::function<json(const json&)> RequestListener;
         typedef std::string EventIdentifier;
         typedef std::string RequestIdentifier;
+        typedef uint64_t ListenerId;
+
+        /*
+         * Per-subscription delivery options, sent to the bridge with the
+         * addEventListener frame (see lib/outbound-queue.js):
+         *
+         *   DropOldest - while this client is slow, keep at most maxQueue
+         *                events and drop the oldest
+         *   Conflate   - while this client is slow, keep only the latest
+         *   Disconnect - drop the connection if this client is slow
+         *   Latest     - always deliver only the newest pending value, on
+         *                the bridge and again in the reader, so the
+         *                callback sees at most one update per dispatch
+         *                cycle
+         *
+         * A non-empty filter is evaluated by the bridge before the event is
+         * serialized, and again locally for this listener; sample clauses
+         * only locally, per listener.
+         */
+        struct SubscriptionOptions {
+            enum Policy { Default, DropOldest, Conflate, Disconnect, Latest };
+
+            Policy policy;
+            size_t maxQueue;
+            bits::EventFilter filter;
+
+            SubscriptionOptions(Policy policy=Default, size_t maxQueue=0) :
+                policy(policy),
+                maxQueue(maxQueue) {}
+
+            SubscriptionOptions(const bits::EventFilter &filter) :
+                policy(Default),
+                maxQueue(0),
+                filter(filter) {}
+
+            /**
+             * The params[1] object for the bridge, null for defaults
+             */
+            json toJson() const {
+                static const char *names[] = {
+                    nullptr, "dropOldest", "conflate", "disconnect", "latest"
+                };
+                json options;
+                if (policy != Default) {
+                    options["policy"] = names[policy];
+                }
+                if (maxQueue > 0) {
+                    options["maxQueue"] = maxQueue;
+                }
+                json pushed = filter.toJson();
+                if (!pushed.is_null()) {
+                    options["filter"] = pushed;
+                }
+                return options;
+            }
+        };
+
+        /*
+         * Options for a request handler, sent to the bridge with the
+         * addRequestListener frame. Every client serving the same
+         * (request, scopes) joins one worker group on the bridge, which
+         * hands each request to a single member (see lib/worker-group.js):
+         *
+         *   LeastLoaded - the client with the fewest requests in flight
+         *   RoundRobin  - each client in turn
+         *   Shard       - by consistent hash of the param at shardKey
+         *                 (e.g. "0.entityId"), so every request for a key
+         *                 reaches the same client while it is connected;
+         *                 workerId names this client on the hash ring
+         *
+         * The first client to register decides the group's balancing.
+         */
+        struct RequestOptions {
+            enum Balance { Default, LeastLoaded, RoundRobin, Shard };
+
+            Balance balance;
+            std::string shardKey;
+            std::string workerId;
+
+            RequestOptions(Balance balance=Default) :
+                balance(balance) {}
+
+            explicit RequestOptions(const std::string &shardKey, const std::string &workerId="") :
+                balance(Shard),
+                shardKey(shardKey),
+                workerId(workerId) {}
+
+            /**
+             * The params[1] object for the bridge, null for defaults
+             */
+            json toJson() const {
+                static const char *names[] = {
+                    nullptr, "leastLoaded", "roundRobin", "shard"
+                };
+                json options;
+                if (balance != Default) {
+                    options["balance"] = names[balance];
+                }
+                if (!shardKey.empty()) {
+                    options["shardKey"] = shardKey;
+                }
+                if (!workerId.empty()) {
+                    options["workerId"] = workerId;
+                }
+                return options;
+            }
+        };
+
+        /*
+         * Latency of one event or request name, in nanoseconds:
+         *
+         *   queue    - from reading the frame to starting its callbacks
+         *   callback - run time of each callback
+         */
+        struct HandlerTimingSnapshot {
+            bits::HistogramSnapshot queue;
+            bits::HistogramSnapshot callback;
+        };
+
+        /*
+         * See timings()
+         */
+        struct TimingSnapshot {
+            // sendRequest round trips per request name
+            std::map<std::string, bits::HistogramSnapshot> requestRtt;
+            std::map<std::string, HandlerTimingSnapshot> events;
+            std::map<std::string, HandlerTimingSnapshot> requests;
+            // time between consecutive latency stamps of received frames,
+            // keyed "from->to", e.g. "bridge-recv->bits-dispatch"; the
+            // first to last hop is included when there are more than two
+            std::map<std::string, bits::HistogramSnapshot> hops;
+        };
+
+        /*
+         * Counters (totals since construction) and gauges, see metrics()
+         */
+        struct Metrics {
+            uint64_t framesSent;
+            uint64_t bytesSent;
+            // frames that could not be written to the socket
+            uint64_t sendFailures;
+            uint64_t framesReceived;
+            uint64_t bytesReceived;
+            // received frames that were not valid JSON
+            uint64_t parseErrors;
+            // frames whose handling threw, e.g. malformed envelopes or
+            // exceptions from callbacks
+            uint64_t dispatchErrors;
+            // frames nobody handled: events without listeners, requests
+            // without handlers, responses nobody waits for
+            uint64_t droppedFrames;
+            // events skipped by Latest listeners
+            uint64_t supersededEvents;
+
+            uint64_t pendingRequests;
+            uint64_t eventListeners;
+            uint64_t requestListeners;
+            // received bytes not yet dispatched, in the client buffer and
+            // in the kernel; bytes written but not yet read by the server
+            uint64_t readBufferBytes;
+            uint64_t receiveQueueBytes;
+            uint64_t sendQueueBytes;
+        };
 
     //////////////////////////////////////////////////////////////////////////
     // Public Methods
@@ -69,7 +249,6 @@ class MessageCenter {
          * MessageCenter destructor
          */
         ~MessageCenter() {
-            _stopEvent = true;
             stop();
         }
 
@@ -104,6 +283,7 @@ class MessageCenter {
             // Set socket RCV timeout to one second
             struct timeval tv;
             tv.tv_sec = 1;
+            tv.tv_usec = 0;
             setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, (struct timeval *)&tv, sizeof(struct timeval));
 
             if (async) {
@@ -115,41 +295,53 @@ class MessageCenter {
         }
 
         /**
-         * Stop the MessageCenter background thread.
+         * Stop the MessageCenter background thread and close the socket.
+         * Requests still waiting for a response return null.
          */
         void stop() {
-            _readThread.join();
+            _stopEvent = true;
+            if (_fd > 0) {
+                // wake up a reader blocked in read()
+                shutdown(_fd, SHUT_RDWR);
+            }
+            if (_readThread.joinable()) {
+                _readThread.join();
+            }
+            _wakeRequests();
+            std::lock_guard<std::mutex> lock(_fd_wr_mutex);
+            if (_fd > 0) {
+                close(_fd);
+                _fd = 0;
+            }
         }
 
         /**
          * Read up to 'max' messages.
          *
+         * Each dispatch cycle reads one frame plus every complete frame
+         * already buffered behind it and dispatches them in order, so
+         * Latest listeners can skip values superseded within the cycle.
+         *
          * TODO - add timeout, requires nonblock get() timeout support
          */
         void dispatchMessages(const size_t max=0) {
             size_t nReceived = 0;
+            std::vector<json> batch;
+            std::vector<Clock::time_point> arrivals;
+            std::string data;
             while (!_stopEvent) {  
                 // Read the next data segment
-                std::string data = _get();
-                if (data.size() > 0) {
-                    // Attempt to parse it
-                    try {
-                      json msg = json::parse(data);
-                      ++nReceived;
-                      if (msg["data"]["type"] == "event") {
-                          this->_handleEvent(msg["data"]);
-                      } else if (msg["data"]["type"] == "response") {
-                          this->_handleResponse(msg["data"]);
-                      } else if (msg["data"]["type"] == "request") {
-                          this->_handleRequest(msg["data"]);
-                      }
-                    } catch(...) {
-                        continue;
-                    }
+                if (!_get(data)) {
+                    continue;
+                }
 
-                    if (max > 0 && nReceived >= max) {
-                        break;
-                    }
+                _parseCycle(data, _lastRead, batch, arrivals, max == 0 ? 0 : max - nReceived,
+                            [this](std::string &next) { return this->_getBuffered(next); });
+                nReceived += batch.size();
+                _dispatchBatch(batch, arrivals);
+
+                if (max > 0 && nReceived >= max) {
+                    break;
                 }
             }
         }
@@ -158,7 +350,7 @@ class MessageCenter {
          * Send a request BITS using the default scope
          */ 
         template<typename... Args>
-        json sendRequest(const std::string &request, Args... args) {
+        json sendRequest(const std::string &request, const Args&... args) {
             return sendRequest(request, {}, args...);
         }
 
@@ -168,45 +360,15 @@ class MessageCenter {
         template<typename... Args>
         json sendRequest(const std::string &request, const std::vector<std::string> scopes) {
             std::string requestId = _getRequestId();
-            json msg;
-
-            msg["type"] = "bits-ipc";
-            msg["data"] = {};
-
-            msg["data"]["type"] = "request";
-            msg["data"]["event"] = request;
-            msg["data"]["requestId"] = requestId;
-            msg["data"]["params"] = { };
-
-            if (scopes.size() == 0) {
-                msg["data"]["params"].push_back( { { "scope", nullptr } } );
-            } else if (scopes.size() == 1) {
-                msg["data"]["params"].push_back( { { "scopes", { scopes[0] } } } );
-            } else {
-                msg["data"]["params"].push_back( { { "scopes", scopes } } );
-            }
-
-            this->_send(msg.dump());
-
-            std::mutex _resp_mutex;
-            json resp;
-
-            this->_addReponseListener(requestId, scopes, [&](const json &msg) {
-                std::lock_guard<std::mutex> lock(_resp_mutex); 
-                resp = msg;
-            });
-
-            while (true) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                {
-                    std::lock_guard<std::mutex> lock(_resp_mutex); 
-                    if (!resp.is_null()) {
-                        break;
-                    }
-                }
-            }
-
-            return resp;
+            std::string &frame = _frameBuffer();
+            bits::FrameWriter writer(frame);
+            writer.beginFrame("request", request);
+            writer.member("requestId", requestId);
+            writer.beginParams();
+            writer.scope(scopes);
+            _endFrame(writer);
+
+            return this->_request(request.c_str(), requestId, frame);
         }
 
         /**
@@ -216,50 +378,19 @@ class MessageCenter {
         json sendRequest(
             const std::string &request,
             const std::vector<std::string> scopes,
-            Args... args
+            const Args&... args
         ) {
             std::string requestId = _getRequestId();
-            json msg;
-
-            msg["type"] = "bits-ipc";
-            msg["data"] = {};
-
-            msg["data"]["type"] = "request";
-            msg["data"]["event"] = request;
-            msg["data"]["requestId"] = requestId;
-            msg["data"]["params"] = { };
-
-            if (scopes.size() == 0) {
-                msg["data"]["params"].push_back( { { "scope", nullptr } } );
-            } else if (scopes.size() == 1) {
-                msg["data"]["params"].push_back( { { "scopes", { scopes[0] } } } );
-            } else {
-                msg["data"]["params"].push_back( { { "scopes", scopes } } );
-            }
-
-            concatArgs(msg["data"]["params"], args...);
-
-            this->_send(msg.dump());
-
-            std::mutex _resp_mutex;
-            json resp;
-
-            this->_addReponseListener(requestId, scopes, [&](const json &msg) {
-                std::lock_guard<std::mutex> lock(_resp_mutex); 
-                resp = msg;
-            });
-
-            while (true) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                {
-                    std::lock_guard<std::mutex> lock(_resp_mutex); 
-                    if (!resp.is_null()) {
-                        break;
-                    }
-                }
-            }
-
-            return resp;
+            std::string &frame = _frameBuffer();
+            bits::FrameWriter writer(frame);
+            writer.beginFrame("request", request);
+            writer.member("requestId", requestId);
+            writer.beginParams();
+            writer.scope(scopes);
+            _writeParams(writer, args...);
+            _endFrame(writer);
+
+            return this->_request(request.c_str(), requestId, frame);
         }
        
 
@@ -267,7 +398,7 @@ class MessageCenter {
          * Send an event to BITS using the default scope.
          */
         template<typename... Args>
-        bool sendEvent(const std::string &event, Args... args) {
+        bool sendEvent(const std::string &event, const Args&... args) {
             return sendEvent(event, {}, args...);
         }
 
@@ -276,24 +407,14 @@ class MessageCenter {
          */
         template<typename... Args>
         bool sendEvent(const std::string &event, const std::vector<std::string> scopes) {
-            json msg;
-
-            msg["type"] = "bits-ipc";
-            msg["data"] = {};
-
-            msg["data"]["type"] = "event";
-            msg["data"]["event"] = event;
-            msg["data"]["params"] = { };
-
-            if (scopes.size() == 0) {
-                msg["data"]["params"].push_back( { { "scope", nullptr } } );
-            } else if (scopes.size() == 1) {
-                msg["data"]["params"].push_back( { { "scopes", { scopes[0] } } } );
-            } else {
-                msg["data"]["params"].push_back( { { "scopes", scopes } } );
-            }
-
-            return this->_send(msg.dump());
+            std::string &frame = _frameBuffer();
+            bits::FrameWriter writer(frame);
+            writer.beginFrame("event", event);
+            writer.beginParams();
+            writer.scope(scopes);
+            _endFrame(writer);
+
+            return this->_write(frame);
         }
 
         /**
@@ -303,270 +424,1682 @@ class MessageCenter {
         bool sendEvent(
             const std::string &event,
             const std::vector<std::string> scopes,
-            Args... args
+            const Args&... args
         ) {
-            json msg;
-
-            msg["type"] = "bits-ipc";
-            msg["data"] = {};
-
-            msg["data"]["type"] = "event";
-            msg["data"]["event"] = event;
-            msg["data"]["params"] = { };
-
-            if (scopes.size() == 0) {
-                msg["data"]["params"].push_back( { { "scope", nullptr } } );
-            } else if (scopes.size() == 1) {
-                msg["data"]["params"].push_back( { { "scopes", { scopes[0] } } } );
-            } else {
-                msg["data"]["params"].push_back( { { "scopes", scopes } } );
-            }
-
-            concatArgs(msg["data"]["params"], args...);
-
-            return this->_send(msg.dump());
+            std::string &frame = _frameBuffer();
+            bits::FrameWriter writer(frame);
+            writer.beginFrame("event", event);
+            writer.beginParams();
+            writer.scope(scopes);
+            _writeParams(writer, args...);
+            _endFrame(writer);
+
+            return this->_write(frame);
         }
        
         /**
          * Register with BITS to receive events on the default scope.
          */ 
-        void addEventListener(const std::string &event, const EventCallback &cb) {
-            addEventListener(event, {}, cb);
+        ListenerId addEventListener(const std::string &event, const EventCallback &cb) {
+            return addEventListener(event, {}, cb);
         }
 
         /**
-         * Register with BITS to receive events.
+         * Register with BITS to receive events. Only the first listener
+         * for an (event, scopes) pair subscribes on the server, further
+         * listeners share that subscription and are fanned out locally.
          */
-        void addEventListener(
+        ListenerId addEventListener(
             const std::string &event,
             const std::vector<std::string> &scopes,
-            const EventCallback &cb
+            const EventCallback &cb,
+            const SubscriptionOptions &options=SubscriptionOptions()
         ) {
-            _eventListeners[event].push_back(cb);
-
-            json msg;
-            msg["type"] = "bits-ipc";
-            msg["data"] = {};
-
-            msg["data"]["type"] = "addEventListener";
-            msg["data"]["event"] = event;
-            msg["data"]["params"] = { };
+            return _addListener(&ListenerRegistry::events, false, event, scopes, cb, options);
+        }
 
-            if (scopes.size() == 0) {
-                msg["data"]["params"].push_back( { { "scopes", nullptr } } );
-            } else if (scopes.size() == 1) {
-                msg["data"]["params"].push_back( { { "scopes", scopes[0] } } );
-            } else {
-                msg["data"]["params"].push_back( { { "scopes", scopes } } );
-            }
-            this->_send(msg.dump());
+        /**
+         * Remove a listener returned by addEventListener. The server
+         * subscription is dropped with the last listener for its
+         * (event, scopes) pair.
+         */
+        bool removeEventListener(ListenerId id) {
+            return _removeListener(&ListenerRegistry::events, false, id);
         }
 
         /**
          * Register with BITS to handle requests on the default scope
          */ 
-        void addRequestListener(
+        ListenerId addRequestListener(
             const std::string &event,
             const RequestListener &cb
         ) {
-            addRequestListener(event, {}, cb);
+            return addRequestListener(event, {}, cb);
         }
 
         /**
-         * Register with BITS to handle requests on the default scope
+         * Register with BITS to handle requests. The most recently added
+         * handler for a request on the requested scopes answers it;
+         * removing it falls back to the previous one. Across processes, the bridge balances requests
+         * over every client serving them as set by options.
          */
-        void addRequestListener(
+        ListenerId addRequestListener(
             const std::string &event,
             const std::vector<std::string> &scopes,
-            const RequestListener &cb
+            const RequestListener &cb,
+            const RequestOptions &options=RequestOptions()
         ) {
-            _requestListeners[event] = cb;
-
-            json msg;
-            msg["type"] = "bits-ipc";
-            msg["data"] = {};
+            return _addListener(&ListenerRegistry::requests, true, event, scopes, cb, options);
+        }
 
-            msg["data"]["type"] = "addRequestListener";
-            msg["data"]["event"] = event;
-            msg["data"]["params"] = { };
+        /**
+         * Remove a handler returned by addRequestListener
+         */
+        bool removeRequestListener(ListenerId id) {
+            return _removeListener(&ListenerRegistry::requests, true, id);
+        }
 
-            if (scopes.size() == 0) {
-                msg["data"]["params"].push_back( { { "scopes", nullptr } } );
-            } else if (scopes.size() == 1) {
-                msg["data"]["params"].push_back( { { "scopes", { scopes[0] } } } );
-            } else {
-                msg["data"]["params"].push_back( { { "scopes", scopes } } );
+        /**
+         * Current counters and gauges
+         */
+        Metrics metrics() {
+            Metrics m = Metrics();
+            m.framesSent = _counters.framesSent.load();
+            m.bytesSent = _counters.bytesSent.load();
+            m.sendFailures = _counters.sendFailures.load();
+            m.framesReceived = _counters.framesReceived.load();
+            m.bytesReceived = _counters.bytesReceived.load();
+            m.parseErrors = _counters.parseErrors.load();
+            m.dispatchErrors = _counters.dispatchErrors.load();
+            m.droppedFrames = _counters.droppedFrames.load();
+            m.supersededEvents = _counters.supersededEvents.load();
+            {
+                std::lock_guard<std::mutex> lock(_response_mutex);
+                m.pendingRequests = _pendingResponses.size();
             }
-            this->_send(msg.dump());
+            {
+                bits::RcuCell<ListenerRegistry>::ReadGuard listeners(_listeners);
+                m.eventListeners = _countListeners(listeners->events);
+                m.requestListeners = _countListeners(listeners->requests);
+            }
+            m.readBufferBytes = _counters.readBufferBytes.load();
+
+            // the socket stays open until stop() takes the write lock
+            std::lock_guard<std::mutex> lock(_fd_wr_mutex);
+            int queued = 0;
+            const int fd = _fd;
+            m.receiveQueueBytes = fd > 0 && ioctl(fd, FIONREAD, &queued) == 0 ? queued : 0;
+            queued = 0;
+            m.sendQueueBytes = fd > 0 && ioctl(fd, TIOCOUTQ, &queued) == 0 ? queued : 0;
+            return m;
         }
 
+        /**
+         * metrics() and timings() in the Prometheus text exposition
+         * format, for a /metrics endpoint or the node exporter's textfile
+         * collector
+         */
+        std::string prometheus(const std::string &prefix="bits_ipc_client") {
+            Metrics m = metrics();
+            std::ostringstream out;
+
+            const struct {
+                const char *name;
+                const char *type;
+                uint64_t value;
+                const char *help;
+            } values[] = {
+                { "frames_sent_total", "counter", m.framesSent, "Frames written to the bridge" },
+                { "bytes_sent_total", "counter", m.bytesSent, "Bytes written to the bridge" },
+                { "send_failures_total", "counter", m.sendFailures, "Frames that could not be written" },
+                { "frames_received_total", "counter", m.framesReceived, "Frames read from the bridge" },
+                { "bytes_received_total", "counter", m.bytesReceived, "Bytes read from the bridge" },
+                { "parse_errors_total", "counter", m.parseErrors, "Received frames that were not valid JSON" },
+                { "dispatch_errors_total", "counter", m.dispatchErrors, "Frames whose handling failed" },
+                { "dropped_frames_total", "counter", m.droppedFrames, "Received frames nobody handled" },
+                { "superseded_events_total", "counter", m.supersededEvents, "Events skipped by Latest listeners" },
+                { "pending_requests", "gauge", m.pendingRequests, "Requests waiting for a response" },
+                { "event_listeners", "gauge", m.eventListeners, "Registered event listeners" },
+                { "request_listeners", "gauge", m.requestListeners, "Registered request handlers" },
+                { "read_buffer_bytes", "gauge", m.readBufferBytes, "Bytes read but not yet dispatched" },
+                { "receive_queue_bytes", "gauge", m.receiveQueueBytes, "Bytes waiting in the socket receive queue" },
+                { "send_queue_bytes", "gauge", m.sendQueueBytes, "Bytes waiting in the socket send queue" }
+            };
+            for (auto &&v : values) {
+                out << "# HELP " << prefix << "_" << v.name << " " << v.help << "\n"
+                    << "# TYPE " << prefix << "_" << v.name << " " << v.type << "\n"
+                    << prefix << "_" << v.name << " " << v.value << "\n";
+            }
 
-    //////////////////////////////////////////////////////////////////////////
-    // Internal Methods & Variables
-    private:
-        // the delimiter used by node-ipc
-        const char* DELIMITER = "\f";
-
-        // private member variables
-        std::string _socket_path;
-        int _fd;
-        unsigned int _requestId;
-        std::thread _readThread;
-        bool _stopEvent;
-
-        // Thread-lock mutex for protected members
-        std::mutex _fd_wr_mutex;
-        std::mutex _fd_rd_mutex;
-        std::mutex _requestId_mutex;
-
-        // Listeners and handlers
-        std::unordered_map< EventIdentifier, std::vector<EventCallback> > _eventListeners;
-        std::unordered_map< RequestIdentifier, EventCallback > _responseListeners;
-        std::unordered_map< EventIdentifier, RequestListener > _requestListeners;
+            TimingSnapshot t = timings();
+            _prometheusHeader(out, prefix + "_request_rtt_seconds",
+                              "sendRequest round trip time");
+            for (auto &&h : t.requestRtt) {
+                _prometheusSummary(out, prefix + "_request_rtt_seconds", nullptr,
+                                   "name=" + _prometheusLabel(h.first), h.second);
+            }
+            _prometheusHeader(out, prefix + "_handler_queue_seconds",
+                              "Time from reading a frame to starting its callbacks");
+            for (auto &&h : t.events) {
+                _prometheusSummary(out, prefix + "_handler_queue_seconds", nullptr,
+                                   "kind=\"event\",name=" + _prometheusLabel(h.first), h.second.queue);
+            }
+            for (auto &&h : t.requests) {
+                _prometheusSummary(out, prefix + "_handler_queue_seconds", nullptr,
+                                   "kind=\"request\",name=" + _prometheusLabel(h.first), h.second.queue);
+            }
+            _prometheusHeader(out, prefix + "_handler_callback_seconds",
+                              "Run time of each callback");
+            for (auto &&h : t.events) {
+                _prometheusSummary(out, prefix + "_handler_callback_seconds", nullptr,
+                                   "kind=\"event\",name=" + _prometheusLabel(h.first), h.second.callback);
+            }
+            for (auto &&h : t.requests) {
+                _prometheusSummary(out, prefix + "_handler_callback_seconds", nullptr,
+                                   "kind=\"request\",name=" + _prometheusLabel(h.first), h.second.callback);
+            }
+            _prometheusHeader(out, prefix + "_hop_latency_seconds",
+                              "Time between latency stamps of received frames");
+            for (auto &&h : t.hops) {
+                _prometheusSummary(out, prefix + "_hop_latency_seconds", nullptr,
+                                   "hop=" + _prometheusLabel(h.first), h.second);
+            }
+            return out.str();
+        }
 
         /**
-         * Send a message on the socket, conforming to
-         * node-ipc by adding a \f delimiter
+         * Latency histograms recorded since start or the last reset:
+         * sendRequest round trips per request name, and queueing and
+         * callback time per event and request name. With reset, start a
+         * new interval.
          */
-        bool _send(const std::string &msg) {
-            std::lock_guard<std::mutex> lock(_fd_wr_mutex); 
+        TimingSnapshot timings(bool reset=false) {
+            TimingSnapshot snapshot;
 
-            if (_fd == 0) {
-                return false;
+            bits::RcuCell<ListenerRegistry>::ReadGuard listeners(_listeners);
+            for (bits::InternedId id = 0; id < listeners->requestRtt.size(); ++id) {
+                snapshot.requestRtt[listeners->requestRtt.name(id)] =
+                    listeners->requestRtt.at(id)->snapshot(reset);
             }
-
-            if (write(_fd, msg.c_str(), msg.size()) != msg.size()) {
-                return false;
+            for (bits::InternedId id = 0; id < listeners->events.size(); ++id) {
+                snapshot.events[listeners->events.name(id)] =
+                    listeners->events.at(id).timings->snapshot(reset);
+            }
+            for (bits::InternedId id = 0; id < listeners->requests.size(); ++id) {
+                snapshot.requests[listeners->requests.name(id)] =
+                    listeners->requests.at(id).timings->snapshot(reset);
             }
 
-            if (write(_fd, DELIMITER, strlen(DELIMITER)) != 1) {
-                return false;
+            for (size_t from = 0; from < HOP_COUNT; ++from) {
+                for (size_t to = 0; to < HOP_COUNT; ++to) {
+                    bits::Histogram *histogram = _hopTimings.pairs[from][to].load();
+                    if (histogram != nullptr) {
+                        snapshot.hops[std::string(HOP_NAMES[from]) + "->" + HOP_NAMES[to]] =
+                            histogram->snapshot(reset);
+                    }
+                }
             }
+            return snapshot;
+        }
 
-            return true;
+        /**
+         * The last frames sent and received, for post mortems: dump them
+         * with flightRecorder().dump(fd), or on a signal with
+         * flightRecorder().dumpOnSignal(SIGUSR2). On by default.
+         */
+        bits::FlightRecorder &flightRecorder() {
+            return _flightRecorder;
         }
 
         /**
-         * Get the next message from the socket
+         * Append every frame sent and received from now on, with its
+         * time, to a memory-mapped capture file at path (see
+         * CaptureFile.h). replay feeds captures back through
+         * inject().
          */
-        std::string _get() {
-            std::lock_guard<std::mutex> lock(_fd_rd_mutex);
+        bool startCapture(const std::string &path) {
+            return _capture.open(path);
+        }
 
-            static std::string _buffer;
-            char buf[1024];
-            ssize_t rc;
-            size_t idx;
+        void stopCapture() {
+            _capture.close();
+        }
 
-            while ( (rc = read(_fd, buf, sizeof(buf)-1)) > 0) {
-                if (_stopEvent) {
-                    return "";
-                }
-                // Null terminate the string
-                buf[rc] = '\0';
-                // Append to the buffer
-                _buffer.append(buf);
-                // Find the delimiter
-                if ((idx = _buffer.find_first_of("\f")) != std::string::npos) {
-                    // Extract the message
-                    std::string msg = _buffer.substr(0, idx);
-                    // Delete the message from the buffer
-                    _buffer.erase(0, idx+1);
-                    
-                    return msg;
-                } 
+        /**
+         * Frame, parse and dispatch size bytes of the wire stream as if
+         * one read() had returned them: every complete frame (delimiter
+         * included) is dispatched in one cycle, as dispatchMessages()
+         * does, and a partial frame at the end waits for the next call.
+         * The socket counters and the flight recorder are left alone;
+         * responses to injected requests are sent if connected. Returns
+         * the frames parsed.
+         */
+        size_t inject(const char *data, size_t size) {
+            std::lock_guard<std::mutex> lock(_inject_mutex);
+            _injectBuffer.erase(0, _injectOffset);
+            _injectOffset = 0;
+            _injectBuffer.append(data, size);
+
+            const Clock::time_point arrival = Clock::now();
+            std::string &frame = _injectFrame;
+            if (!_takeFrame(_injectBuffer, _injectOffset, frame)) {
+                return 0;
             }
-
-            return "";
+            _parseCycle(frame, arrival, _injectBatch, _injectArrivals, 0,
+                        [this](std::string &next) {
+                            return _takeFrame(_injectBuffer, _injectOffset, next);
+                        });
+            _dispatchBatch(_injectBatch, _injectArrivals);
+            return _injectBatch.size();
         }
 
         /**
-         * Spawns the dispatchMessage in a loop.
+         * Add a "stamps" member to every event, request and response
+         * frame sent, holding the CLOCK_MONOTONIC time of the send. The bridge appends a stamp
+         * per hop (bridge-recv, bits-dispatch, bridge-send) and the
+         * receiving MessageCenter adds client-recv and client-dispatch,
+         * then records the time spent in each hop (see timings().hops).
+         * Only meaningful between processes on the same host.
          */
-        std::thread _spawn() {
-            return std::thread( [this] { this->dispatchMessages(); } );
+        void setLatencyStamps(bool enabled) {
+            _latencyStamps = enabled;
         }
 
+        /*
+         * Owns one listener registration. Destroying or reset()ing the
+         * handle removes the listener locally and, with the last local
+         * listener, on the bridge.
+         */
+        class Subscription {
+            public:
+                Subscription() : _center(nullptr), _id(0), _request(false) {}
+
+                Subscription(MessageCenter &center, ListenerId id, bool request) :
+                    _center(&center), _id(id), _request(request) {}
+
+                Subscription(Subscription &&other) :
+                    _center(other._center), _id(other._id), _request(other._request)
+                {
+                    other._center = nullptr;
+                }
+
+                Subscription &operator=(Subscription &&other) {
+                    if (this != &other) {
+                        reset();
+                        _center = other._center;
+                        _id = other._id;
+                        _request = other._request;
+                        other._center = nullptr;
+                    }
+                    return *this;
+                }
+
+                ~Subscription() {
+                    reset();
+                }
+
+                /**
+                 * Unregister now
+                 */
+                void reset() {
+                    if (_center != nullptr) {
+                        if (_request) {
+                            _center->removeRequestListener(_id);
+                        } else {
+                            _center->removeEventListener(_id);
+                        }
+                        _center = nullptr;
+                    }
+                }
+
+                /**
+                 * Give up ownership, the listener stays registered
+                 */
+                ListenerId release() {
+                    _center = nullptr;
+                    return _id;
+                }
+
+                ListenerId id() const {
+                    return _id;
+                }
+
+                explicit operator bool() const {
+                    return _center != nullptr;
+                }
+
+            private:
+                MessageCenter *_center;
+                ListenerId _id;
+                bool _request;
+
+                Subscription(const Subscription &);
+                Subscription &operator=(const Subscription &);
+        };
+
         /**
-         * Get the next requestId
+         * addEventListener returning an owning handle
          */
-        std::string _getRequestId() {
-            std::lock_guard<std::mutex> lock(_requestId_mutex);
-            return std::to_string(_requestId++);
+        Subscription subscribe(const std::string &event, const EventCallback &cb) {
+            return subscribe(event, {}, cb);
+        }
+
+        Subscription subscribe(
+            const std::string &event,
+            const std::vector<std::string> &scopes,
+            const EventCallback &cb,
+            const SubscriptionOptions &options=SubscriptionOptions()
+        ) {
+            return Subscription(*this, addEventListener(event, scopes, cb, options), false);
         }
 
         /**
-         * Add a response listener for the defined requestId
+         * addRequestListener returning an owning handle
          */
-        void _addReponseListener(
-            const std::string &requestId,
+        Subscription serve(const std::string &event, const RequestListener &cb) {
+            return serve(event, {}, cb);
+        }
+
+        Subscription serve(
+            const std::string &event,
             const std::vector<std::string> &scopes,
-            const EventCallback &cb
+            const RequestListener &cb,
+            const RequestOptions &options=RequestOptions()
         ) {
-            // TODO behaviour if requestId already is in the list
-            _responseListeners[requestId] = cb;
+            return Subscription(*this, addRequestListener(event, scopes, cb, options), true);
         }
 
+        //////////////////////////////////////////////////////////////////////
+        // Typed descriptors, see TypedMessages.h
+
         /**
-         * Handle an incoming event, passing it to the eventListeners
+         * Send a typed event using the default scope. The frame is written
+         * directly from the arguments, no json DOM is built.
          */
-        void _handleEvent(const json &msg) {
-            std::string event = msg["event"];
-            auto callbacks = _eventListeners.find(event);
-            if (callbacks != _eventListeners.end()) {
-                for (auto &&cb : callbacks->second) {
-                    cb(msg["params"]);
-                }     
-            }
+        template<typename E, typename... Args>
+        typename bits::detail::Require<typename E::Callback, bool>::type
+        sendEvent(Args&&... args) {
+            return _sendTypedEvent<E>(std::vector<std::string>(), std::forward<Args>(args)...);
         }
 
         /**
-         * Handle an incoming response, passing it to the responseListener
+         * Send a typed event
          */
-        void _handleResponse(const json &msg) {
-            std::string responseId = msg["responseId"];
-            auto callback = _responseListeners.find(responseId);
-            if (callback != _responseListeners.end()) {
-                callback->second(msg["result"]);
-            }
+        template<typename E, typename... Args>
+        typename bits::detail::Require<typename E::Callback, bool>::type
+        sendEvent(const std::vector<std::string> &scopes, Args&&... args) {
+            return _sendTypedEvent<E>(scopes, std::forward<Args>(args)...);
         }
 
         /**
-         * Handle an incoming request, passing it to the requestListener
+         * Send a typed request using the default scope and decode
+         * result[0] into result. False, leaving result alone, if no
+         * usable response arrives: the send failed, the client stopped or
+         * disconnected while waiting, the handler failed, or the result
+         * does not decode.
          */
-        void _handleRequest(const json &msg) {
-            std::string event = msg["event"];
-            auto requestId = msg["requestId"];
-            auto callback = _requestListeners.find(event);
-            if (callback != _requestListeners.end()) {
-                json result = callback->second(msg["params"]);
+        template<typename E, typename... Args>
+        typename bits::detail::Require<typename E::Handler, bool>::type
+        sendRequest(typename E::ResultType &result, Args&&... args) {
+            return _sendTypedRequest<E>(std::vector<std::string>(), result,
+                                        std::forward<Args>(args)...);
+        }
 
-                json resp;
-                resp["type"] = "bits-ipc";
-                resp["data"] = {};
+        /**
+         * Send a typed request and decode result[0] into result
+         */
+        template<typename E, typename... Args>
+        typename bits::detail::Require<typename E::Handler, bool>::type
+        sendRequest(const std::vector<std::string> &scopes, typename E::ResultType &result,
+                    Args&&... args) {
+            return _sendTypedRequest<E>(scopes, result, std::forward<Args>(args)...);
+        }
 
-                resp["data"]["type"] = "response";
-                resp["data"]["event"] = event;
-                resp["data"]["responseId"] = requestId;
-                resp["data"]["params"] = { };
-                resp["data"]["params"].push_back(result);
+        /**
+         * Register a typed event listener on the default scope
+         */
+        template<typename E>
+        typename bits::detail::Require<typename E::Callback, ListenerId>::type
+        addEventListener(const typename E::Callback &cb) {
+            return addEventListener<E>({}, cb);
+        }
 
-                this->_send(resp.dump());
-            }
+        /**
+         * Register a typed event listener. Frames with fewer params than
+         * the descriptor declares are ignored.
+         */
+        template<typename E>
+        typename bits::detail::Require<typename E::Callback, ListenerId>::type
+        addEventListener(
+            const std::vector<std::string> &scopes,
+            const typename E::Callback &cb,
+            const SubscriptionOptions &options=SubscriptionOptions()
+        ) {
+            return addEventListener(E::name(), scopes, [cb](const json &params) {
+                if (params.size() >= E::arity) {
+                    bits::detail::applyParams<void, 0, typename E::ParamTuple>(cb, params);
+                }
+            }, options);
         }
 
         /**
-         * Prevent copy
+         * Register a typed request handler on the default scope
          */
-        MessageCenter(const MessageCenter& other) {
+        template<typename E>
+        typename bits::detail::Require<typename E::Handler, ListenerId>::type
+        addRequestListener(const typename E::Handler &handler) {
+            return addRequestListener<E>({}, handler);
         }
 
         /**
-         * Prevent assignment
+         * Register a typed request handler
          */
-        MessageCenter& operator=(MessageCenter) {
-            return *this;
+        template<typename E>
+        typename bits::detail::Require<typename E::Handler, ListenerId>::type
+        addRequestListener(
+            const std::vector<std::string> &scopes,
+            const typename E::Handler &handler,
+            const RequestOptions &options=RequestOptions()
+        ) {
+            return addRequestListener(E::name(), scopes, [handler](const json &params) {
+                return json(bits::detail::applyParams<
+                    typename E::ResultType, 0, typename E::ParamTuple>(handler, params));
+            }, options);
         }
 
-};
+        /**
+         * Typed subscribe / serve, see Subscription
+         */
+        template<typename E>
+        typename bits::detail::Require<typename E::Callback, Subscription>::type
+        subscribe(
+            const typename E::Callback &cb,
+            const std::vector<std::string> &scopes = {},
+            const SubscriptionOptions &options=SubscriptionOptions()
+        ) {
+            return Subscription(*this, addEventListener<E>(scopes, cb, options), false);
+        }
+
+        template<typename E>
+        typename bits::detail::Require<typename E::Handler, Subscription>::type
+        serve(
+            const typename E::Handler &handler,
+            const std::vector<std::string> &scopes = {},
+            const RequestOptions &options=RequestOptions()
+        ) {
+            return Subscription(*this, addRequestListener<E>(scopes, handler, options), true);
+        }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Internal Methods & Variables
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        // the delimiter used by node-ipc
+        const char* DELIMITER = "\f";
+
+        // private member variables
+        std::string _socket_path;
+        // read without a lock by the reader thread and metrics()
+        std::atomic<int> _fd;
+        unsigned int _requestId;
+        std::thread _readThread;
+        std::atomic<bool> _stopEvent;
+        std::atomic<bool> _latencyStamps{false};
+        std::string _readBuffer;
+        // start of the first frame not yet taken from _readBuffer
+        size_t _readOffset = 0;
+        // when the last read() returned, i.e. when buffered frames arrived
+        Clock::time_point _lastRead;
+        // inject()'s stream, framed like _readBuffer, and its cycle
+        std::mutex _inject_mutex;
+        std::string _injectBuffer;
+        size_t _injectOffset = 0;
+        std::string _injectFrame;
+        std::vector<json> _injectBatch;
+        std::vector<Clock::time_point> _injectArrivals;
+
+        // Thread-lock mutex for protected members
+        std::mutex _fd_wr_mutex;
+        std::mutex _fd_rd_mutex;
+        std::mutex _requestId_mutex;
+        std::mutex _response_mutex;
+
+        /*
+         * Event and request listeners keyed by interned name. The reader
+         * thread dispatches from an immutable snapshot; registration from
+         * other threads publishes a new snapshot (see RcuCell).
+         */
+        template<typename Callback>
+        struct ListenerEntry {
+            ListenerId id;
+            Callback cb;
+            // the scopes registered with, matched against the frame's
+            std::vector<std::string> scopes;
+            bool latest;
+            bits::EventFilter filter;
+            // the tag of the bridge subscription when filter samples, 0
+            // otherwise; the bridge lists the tags it sampled a frame for
+            uint32_t tag;
+        };
+
+        /*
+         * Latency histograms for one name. Every registry version shares
+         * them, so the dispatch path records without taking a lock.
+         */
+        struct HandlerTimings {
+            bits::Histogram queue;
+            bits::Histogram callback;
+
+            HandlerTimingSnapshot snapshot(bool reset) {
+                HandlerTimingSnapshot snapshot = {
+                    queue.snapshot(reset), callback.snapshot(reset)
+                };
+                return snapshot;
+            }
+        };
+
+        template<typename Callback>
+        struct Handlers {
+            std::vector< ListenerEntry<Callback> > listeners;
+            std::shared_ptr<HandlerTimings> timings = std::make_shared<HandlerTimings>();
+        };
+
+        typedef Handlers<EventCallback> EventListeners;
+        typedef Handlers<RequestListener> RequestListeners;
+
+        struct ListenerRegistry {
+            bits::DispatchTable<EventListeners> events;
+            bits::DispatchTable<RequestListeners> requests;
+            // number of event listeners registered with Latest
+            size_t latestListeners = 0;
+            // sendRequest round trips by request name, interned on the
+            // first request for a name
+            bits::DispatchTable< std::shared_ptr<bits::Histogram> > requestRtt;
+        };
+
+        // Listeners and handlers
+        bits::RcuCell<ListenerRegistry> _listeners;
+
+        // Responses awaited by sendRequest callers, guarded by _response_mutex
+        struct PendingResponse {
+            bool done = false;
+            // the response carried an error instead of a result
+            bool failed = false;
+            json result;
+            std::condition_variable cond;
+        };
+        // a vector, as only a handful are in flight and it does not
+        // allocate per request once grown
+        std::vector< std::pair<RequestIdentifier, PendingResponse*> > _pendingResponses;
+
+        /*
+         * The hops latency stamps name, in path order. Stamps are interned
+         * into this fixed set, so recording them builds no strings; hops
+         * with other names are skipped.
+         */
+        static const size_t HOP_COUNT = 6;
+        static constexpr const char *HOP_NAMES[HOP_COUNT] = {
+            "client-send", "bridge-recv", "bits-dispatch", "bridge-send",
+            "client-recv", "client-dispatch"
+        };
+        static const bits::InternedId CLIENT_RECV = 4;
+        static const bits::InternedId CLIENT_DISPATCH = 5;
+
+        /*
+         * Latency histograms per (from, to) hop pair, created on first
+         * use; recording takes no lock
+         */
+        struct HopTimings {
+            std::atomic<bits::Histogram*> pairs[HOP_COUNT][HOP_COUNT];
+
+            HopTimings() {
+                for (auto &&row : pairs) {
+                    for (auto &&pair : row) {
+                        pair = nullptr;
+                    }
+                }
+            }
+
+            ~HopTimings() {
+                for (auto &&row : pairs) {
+                    for (auto &&pair : row) {
+                        delete pair.load();
+                    }
+                }
+            }
+
+            void record(bits::InternedId from, bits::InternedId to, uint64_t ns) {
+                bits::Histogram *histogram = pairs[from][to].load(std::memory_order_acquire);
+                if (histogram == nullptr) {
+                    bits::Histogram *created = new bits::Histogram();
+                    if (pairs[from][to].compare_exchange_strong(histogram, created)) {
+                        histogram = created;
+                    } else {
+                        delete created;
+                    }
+                }
+                histogram->record(ns);
+            }
+        };
+        HopTimings _hopTimings;
+
+        // see Metrics; updated with relaxed atomics on the hot paths
+        struct Counters {
+            std::atomic<uint64_t> framesSent{0};
+            std::atomic<uint64_t> bytesSent{0};
+            std::atomic<uint64_t> sendFailures{0};
+            std::atomic<uint64_t> framesReceived{0};
+            std::atomic<uint64_t> bytesReceived{0};
+            std::atomic<uint64_t> parseErrors{0};
+            std::atomic<uint64_t> dispatchErrors{0};
+            std::atomic<uint64_t> droppedFrames{0};
+            std::atomic<uint64_t> supersededEvents{0};
+            std::atomic<uint64_t> readBufferBytes{0};
+        };
+        Counters _counters;
+        bits::FlightRecorder _flightRecorder;
+        bits::CaptureWriter _capture;
+
+        // Server-side subscriptions, reference counted per (event, scopes)
+        struct SubscriptionKey {
+            bool request;
+            EventIdentifier event;
+            std::string scopes;
+            // serialized SubscriptionOptions, empty for defaults
+            std::string options;
+
+            bool operator<(const SubscriptionKey &other) const {
+                return std::tie(request, event, scopes, options) <
+                       std::tie(other.request, other.event, other.scopes, other.options);
+            }
+        };
+        // listeners sharing a bridge subscription and its tag, if sampled
+        struct Subscribed {
+            size_t listeners = 0;
+            uint32_t tag = 0;
+        };
+        std::mutex _subscription_mutex;
+        ListenerId _lastListenerId = 0;
+        uint32_t _lastTag = 0;
+        std::map< SubscriptionKey, Subscribed > _subscriptions;
+        std::unordered_map< ListenerId, SubscriptionKey > _listenerSubscriptions;
+
+        /**
+         * Close a frame built for sending, with the client-send stamp
+         * while latency stamps are on; the stamp is taken here, so the
+         * hop includes waiting for the socket
+         */
+        void _endFrame(bits::FrameWriter &writer) {
+            if (_latencyStamps) {
+                writer.endFrame("client-send", _monotonicNs(Clock::now()));
+            } else {
+                writer.endFrame();
+            }
+        }
+
+        /**
+         * Write one frame and the delimiter
+         */
+        bool _write(const std::string &msg) {
+            BITS_PROBE2(send_enqueue, msg.data(), msg.size());
+            std::lock_guard<std::mutex> lock(_fd_wr_mutex); 
+
+            // recorded once the write's outcome is known, so a frame that
+            // never reached the socket does not show up as sent
+            if (_fd == 0 ||
+                write(_fd, msg.c_str(), msg.size()) != static_cast<ssize_t>(msg.size()) ||
+                write(_fd, DELIMITER, strlen(DELIMITER)) != 1) {
+                _flightRecorder.record(bits::FlightRecorder::Failed, msg.data(), msg.size());
+                _capture.append(bits::FlightRecorder::Failed, _monotonicNs(Clock::now()), msg.data(), msg.size());
+                _counters.sendFailures.fetch_add(1, std::memory_order_relaxed);
+                BITS_PROBE2(send_done, msg.size(), 0);
+                return false;
+            }
+            _flightRecorder.record(bits::FlightRecorder::Outgoing, msg.data(), msg.size());
+            _capture.append(bits::FlightRecorder::Outgoing, _monotonicNs(Clock::now()), msg.data(), msg.size());
+            BITS_PROBE2(send_done, msg.size(), 1);
+
+            _counters.framesSent.fetch_add(1, std::memory_order_relaxed);
+            _counters.bytesSent.fetch_add(msg.size() + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         * Get the next message from the socket into msg, reusing its
+         * storage. False on timeout, stop or disconnect.
+         */
+        bool _get(std::string &msg) {
+            std::lock_guard<std::mutex> lock(_fd_rd_mutex);
+
+            char buf[65536];
+            ssize_t rc;
+
+            // A previous read may already hold the next message
+            if (_takeBuffered(msg)) {
+                return true;
+            }
+
+            while ( (rc = read(_fd, buf, sizeof(buf))) != 0) {
+                if (rc < 0) {
+                    // receive timeout or interrupted, let the caller
+                    // check for stop
+                    return false;
+                }
+                if (_stopEvent) {
+                    return false;
+                }
+                // Every complete frame in the buffer arrived by now
+                _lastRead = Clock::now();
+                // Drop the frames already taken, then append
+                _readBuffer.erase(0, _readOffset);
+                _readOffset = 0;
+                _readBuffer.append(buf, rc);
+                _counters.bytesReceived.fetch_add(rc, std::memory_order_relaxed);
+                _counters.readBufferBytes.store(_readBuffer.size(), std::memory_order_relaxed);
+                // Find the delimiter
+                if (_takeBuffered(msg)) {
+                    return true;
+                } 
+            }
+
+            // The server closed the connection
+            _stopEvent = true;
+            _wakeRequests();
+            return false;
+        }
+
+        /**
+         * Release sendRequest callers once no response can arrive
+         */
+        void _wakeRequests() {
+            std::lock_guard<std::mutex> lock(_response_mutex);
+            for (auto &&pending : _pendingResponses) {
+                pending.second->cond.notify_one();
+            }
+        }
+
+        /**
+         * Get the next message only if it is already buffered
+         */
+        bool _getBuffered(std::string &msg) {
+            std::lock_guard<std::mutex> lock(_fd_rd_mutex);
+            return _takeBuffered(msg);
+        }
+
+        /**
+         * Extract the first complete message from the read buffer
+         */
+        bool _takeBuffered(std::string &msg) {
+            if (!_takeFrame(_readBuffer, _readOffset, msg)) {
+                return false;
+            }
+            _flightRecorder.record(bits::FlightRecorder::Incoming, msg.data(), msg.size());
+            _capture.append(bits::FlightRecorder::Incoming, _monotonicNs(_lastRead), msg.data(), msg.size());
+            BITS_PROBE2(frame_read, msg.data(), msg.size());
+            _counters.framesReceived.fetch_add(1, std::memory_order_relaxed);
+            _counters.readBufferBytes.store(_readBuffer.size() - _readOffset, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         * Extract the first complete frame at or after offset in buffer
+         * and move offset past its delimiter; the caller compacts the
+         * buffer before appending to it
+         */
+        bool _takeFrame(const std::string &buffer, size_t &offset, std::string &msg) {
+            size_t idx = buffer.find(*DELIMITER, offset);
+            if (idx == std::string::npos) {
+                return false;
+            }
+            msg.assign(buffer, offset, idx - offset);
+            offset = idx + 1;
+            return true;
+        }
+
+        /**
+         * Parse one dispatch cycle into batch: data, then every frame
+         * next() yields until it has none or limit (0 for none) frames
+         * parsed. Frames that do not parse are counted and skipped.
+         */
+        template<typename Next>
+        void _parseCycle(std::string &data, const Clock::time_point &arrival,
+                         std::vector<json> &batch, std::vector<Clock::time_point> &arrivals,
+                         size_t limit, Next next) {
+            batch.clear();
+            arrivals.clear();
+            do {
+                // Attempt to parse it
+                try {
+                    batch.push_back(json::parse(data));
+                    arrivals.push_back(arrival);
+                    BITS_PROBE3(parse_done, data.data(), data.size(), 1);
+                } catch(...) {
+                    _counters.parseErrors.fetch_add(1, std::memory_order_relaxed);
+                    BITS_PROBE3(parse_done, data.data(), data.size(), 0);
+                    continue;
+                }
+            } while ((limit == 0 || batch.size() < limit) && next(data));
+        }
+
+        /**
+         * The frame type of data, empty if it has none
+         */
+        static const std::string &_type(const json &data) {
+            static const std::string none;
+            if (!data.is_object()) {
+                return none;
+            }
+            auto type = data.find("type");
+            return type != data.end() && type->is_string()
+                ? type->get_ref<const std::string&>() : none;
+        }
+
+        /**
+         * The data of a frame whose envelope has every member its handler
+         * reads, with its type; null for a malformed frame
+         */
+        static json *_envelope(json &frame, const std::string *&type) {
+            auto data = frame.find("data");
+            if (data == frame.end() || !data->is_object()) {
+                return nullptr;
+            }
+            type = &_type(*data);
+            if (*type == "event" || *type == "request") {
+                auto event = data->find("event");
+                if (event == data->end() || !event->is_string() ||
+                    data->find("params") == data->end() ||
+                    (*type == "request" && data->find("requestId") == data->end())) {
+                    return nullptr;
+                }
+            } else if (*type == "response") {
+                auto responseId = data->find("responseId");
+                if (responseId == data->end() || !responseId->is_string()) {
+                    return nullptr;
+                }
+            }
+            return &*data;
+        }
+
+        /**
+         * Whether two frames were sent for the same scopes, see
+         * _scopeMatches
+         */
+        static bool _sameScopes(const json &a, const json &b) {
+            auto scopesA = a.find("scopes");
+            auto scopesB = b.find("scopes");
+            if (scopesA == a.end() || scopesB == b.end()) {
+                return scopesA == a.end() && scopesB == b.end();
+            }
+            return *scopesA == *scopesB;
+        }
+
+        /**
+         * Dispatch one cycle of parsed messages in arrival order
+         */
+        void _dispatchBatch(std::vector<json> &batch,
+                            const std::vector<Clock::time_point> &arrivals) {
+            bits::RcuCell<ListenerRegistry>::ReadGuard listeners(_listeners);
+
+            // With Latest listeners around, mark event frames that a later
+            // frame for the same event and scopes supersedes within this
+            // cycle; malformed frames are left to the loop below
+            std::vector<bool> superseded;
+            if (listeners->latestListeners > 0 && batch.size() > 1) {
+                superseded.assign(batch.size(), false);
+                // the data of the later frames per event, one per scopes
+                std::vector< std::vector<const json*> > seen(listeners->events.size());
+                for (size_t i = batch.size(); i-- > 0;) {
+                    const std::string *type = nullptr;
+                    const json *data = _envelope(batch[i], type);
+                    if (data == nullptr || *type != "event") {
+                        continue;
+                    }
+                    bits::InternedId id = listeners->events.find(
+                        (*data)["event"].get_ref<const std::string&>());
+                    if (id == bits::INVALID_ID) {
+                        continue;
+                    }
+                    for (const json *later : seen[id]) {
+                        superseded[i] = superseded[i] || _sameScopes(*data, *later);
+                    }
+                    if (!superseded[i]) {
+                        seen[id].push_back(data);
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+                try {
+                    // compare as strings, comparing with the json holding
+                    // the literal would allocate
+                    const std::string *typeName = nullptr;
+                    json *envelope = _envelope(batch[i], typeName);
+                    if (envelope == nullptr) {
+                        _counters.dispatchErrors.fetch_add(1, std::memory_order_relaxed);
+                        continue;
+                    }
+                    json &data = *envelope;
+                    const std::string &type = *typeName;
+                    if (type == "event") {
+                        this->_handleEvent(data, arrivals[i], !superseded.empty() && superseded[i]);
+                    } else if (type == "response") {
+                        this->_handleResponse(data);
+                    } else if (type == "request") {
+                        this->_handleRequest(data, arrivals[i]);
+                    } else {
+                        _counters.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                    }
+                } catch(...) {
+                    _counters.dispatchErrors.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+        }
+
+        /**
+         * Spawns the dispatchMessage in a loop.
+         */
+        std::thread _spawn() {
+            return std::thread( [this] { this->dispatchMessages(); } );
+        }
+
+        /**
+         * Register cb in the given registry table and subscribe on the
+         * server if it is the first listener for (event, scopes)
+         */
+        template<typename Callback>
+        static ListenerEntry<Callback> _makeEntry(
+            ListenerId id, const Callback &cb, const std::vector<std::string> &scopes,
+            const SubscriptionOptions &options, uint32_t tag
+        ) {
+            ListenerEntry<Callback> entry = {
+                id, cb, scopes, options.policy == SubscriptionOptions::Latest, options.filter, tag
+            };
+            return entry;
+        }
+
+        template<typename Callback>
+        static ListenerEntry<Callback> _makeEntry(
+            ListenerId id, const Callback &cb, const std::vector<std::string> &scopes,
+            const RequestOptions &, uint32_t
+        ) {
+            ListenerEntry<Callback> entry = {
+                id, cb, scopes, false, bits::EventFilter(), 0
+            };
+            return entry;
+        }
+
+        /**
+         * Whether the bridge subscription needs a tag, see ListenerEntry
+         */
+        static bool _sampled(const SubscriptionOptions &options) {
+            return options.filter.sampled();
+        }
+
+        static bool _sampled(const RequestOptions &) {
+            return false;
+        }
+
+        template<typename Listeners, typename Callback, typename Options>
+        ListenerId _addListener(
+            bits::DispatchTable<Listeners> ListenerRegistry::*table,
+            bool request,
+            const std::string &event,
+            const std::vector<std::string> &scopes,
+            const Callback &cb,
+            const Options &options
+        ) {
+            std::lock_guard<std::mutex> lock(_subscription_mutex);
+
+            json optionsJson = options.toJson();
+            SubscriptionKey key = {
+                request, event, _scopeKey(scopes),
+                optionsJson.is_null() ? "" : optionsJson.dump()
+            };
+            Subscribed &subscribed = _subscriptions[key];
+            if (subscribed.listeners == 0) {
+                subscribed.tag = _sampled(options) ? ++_lastTag : 0;
+            }
+
+            ListenerId id = ++_lastListenerId;
+            ListenerEntry<Callback> entry = _makeEntry(id, cb, scopes, options, subscribed.tag);
+            _listeners.update([&](ListenerRegistry &listeners) {
+                bits::DispatchTable<Listeners> &entries = listeners.*table;
+                entries.at(entries.intern(event)).listeners.push_back(entry);
+                listeners.latestListeners += entry.latest ? 1 : 0;
+            });
+
+            _listenerSubscriptions[id] = key;
+            if (subscribed.listeners++ == 0) {
+                this->_sendSubscription(key, "add", subscribed.tag);
+            }
+
+            return id;
+        }
+
+        /**
+         * Undo _addListener, unsubscribing with the last listener
+         */
+        template<typename Listeners>
+        bool _removeListener(
+            bits::DispatchTable<Listeners> ListenerRegistry::*table,
+            bool request,
+            ListenerId id
+        ) {
+            std::lock_guard<std::mutex> lock(_subscription_mutex);
+
+            auto found = _listenerSubscriptions.find(id);
+            if (found == _listenerSubscriptions.end() || found->second.request != request) {
+                return false;
+            }
+            SubscriptionKey key = found->second;
+            _listenerSubscriptions.erase(found);
+
+            _listeners.update([&](ListenerRegistry &listeners) {
+                bits::DispatchTable<Listeners> &entries = listeners.*table;
+                auto &list = entries.at(entries.find(key.event)).listeners;
+                for (auto it = list.begin(); it != list.end(); ++it) {
+                    if (it->id == id) {
+                        listeners.latestListeners -= it->latest ? 1 : 0;
+                        list.erase(it);
+                        break;
+                    }
+                }
+            });
+
+            auto subscribed = _subscriptions.find(key);
+            if (--subscribed->second.listeners == 0) {
+                const uint32_t tag = subscribed->second.tag;
+                _subscriptions.erase(subscribed);
+                this->_sendSubscription(key, "remove", tag);
+            }
+
+            return true;
+        }
+
+        /**
+         * Send an add/remove{Event,Request}Listener frame for key, with
+         * its tag in the options if it has one
+         */
+        bool _sendSubscription(const SubscriptionKey &key, const std::string &action,
+                               uint32_t tag=0) {
+            std::vector<std::string> scopes = _scopesFromKey(key.scopes);
+
+            json msg;
+            msg["type"] = "bits-ipc";
+            msg["data"] = {};
+
+            msg["data"]["type"] = action + (key.request ? "RequestListener" : "EventListener");
+            msg["data"]["event"] = key.event;
+            msg["data"]["params"] = { };
+
+            if (scopes.size() == 0) {
+                msg["data"]["params"].push_back( { { "scopes", nullptr } } );
+            } else if (scopes.size() == 1 && !key.request) {
+                msg["data"]["params"].push_back( { { "scopes", scopes[0] } } );
+            } else {
+                msg["data"]["params"].push_back( { { "scopes", scopes } } );
+            }
+            if (!key.options.empty()) {
+                json options = json::parse(key.options);
+                if (tag != 0) {
+                    options["tag"] = tag;
+                }
+                msg["data"]["params"].push_back(options);
+            }
+            // control frames are not stamped, see setLatencyStamps
+            return this->_write(msg.dump());
+        }
+
+        /**
+         * Flatten scopes into a map key, and back
+         */
+        static std::string _scopeKey(const std::vector<std::string> &scopes) {
+            std::string key;
+            for (auto &&scope : scopes) {
+                key.append(scope);
+                key.push_back('\0');
+            }
+            return key;
+        }
+
+        static std::vector<std::string> _scopesFromKey(const std::string &key) {
+            std::vector<std::string> scopes;
+            size_t start = 0, end;
+            while ((end = key.find('\0', start)) != std::string::npos) {
+                scopes.push_back(key.substr(start, end - start));
+                start = end + 1;
+            }
+            return scopes;
+        }
+
+        /**
+         * Whether a received frame was sent for a listener registered on
+         * scopes. The bridge names the scopes of the BITS listener that
+         * produced the frame, as null, one string or an array; frames
+         * without them (older bridges, the mock server) match every
+         * listener.
+         */
+        static bool _scopeMatches(const json &msg, const std::vector<std::string> &scopes) {
+            auto found = msg.find("scopes");
+            if (found == msg.end()) {
+                return true;
+            }
+            const json &frameScopes = *found;
+            if (frameScopes.is_null()) {
+                return scopes.empty();
+            }
+            if (frameScopes.is_string()) {
+                return scopes.size() == 1 &&
+                    frameScopes.get_ref<const std::string&>() == scopes[0];
+            }
+            if (!frameScopes.is_array() || frameScopes.size() != scopes.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < scopes.size(); ++i) {
+                if (!frameScopes[i].is_string() ||
+                    frameScopes[i].get_ref<const std::string&>() != scopes[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Get the next requestId
+         */
+        std::string _getRequestId() {
+            std::lock_guard<std::mutex> lock(_requestId_mutex);
+            return std::to_string(_requestId++);
+        }
+
+        /**
+         * Write the arguments of the json API straight into the frame,
+         * formatted as json::dump() would format them
+         */
+        static void _writeParams(bits::FrameWriter &) {}
+
+        template<typename T, typename... Args>
+        static void _writeParams(bits::FrameWriter &writer, const T &t, const Args&... rest) {
+            writer.param(t);
+            _writeParams(writer, rest...);
+        }
+
+        /**
+         * Per thread buffer the FrameWriter paths serialize into; it keeps
+         * its capacity, so steady state sends do not allocate
+         */
+        static std::string &_frameBuffer() {
+            static thread_local std::string frame;
+            frame.clear();
+            return frame;
+        }
+
+        /**
+         * Serialize and send a typed event without building a json DOM
+         */
+        template<typename E, typename... Args>
+        bool _sendTypedEvent(const std::vector<std::string> &scopes, Args&&... args) {
+            static_assert(bits::detail::ArgsMatch<typename E::ParamTuple, Args...>::value,
+                          "sendEvent arguments do not match the event descriptor");
+
+            std::string &frame = _frameBuffer();
+            bits::FrameWriter writer(frame);
+            writer.beginFrame("event", E::name());
+            writer.beginParams();
+            writer.scope(scopes);
+            bits::detail::writeParams<typename E::ParamTuple>(writer, std::forward<Args>(args)...);
+            _endFrame(writer);
+
+            return this->_write(frame);
+        }
+
+        /**
+         * Serialize and send a typed request, then decode result[0] into
+         * result; false without a usable response
+         */
+        template<typename E, typename... Args>
+        bool _sendTypedRequest(const std::vector<std::string> &scopes,
+                               typename E::ResultType &result, Args&&... args) {
+            static_assert(bits::detail::ArgsMatch<typename E::ParamTuple, Args...>::value,
+                          "sendRequest arguments do not match the request descriptor");
+
+            std::string requestId = _getRequestId();
+            std::string &frame = _frameBuffer();
+            bits::FrameWriter writer(frame);
+            writer.beginFrame("request", E::name());
+            writer.member("requestId", requestId);
+            writer.beginParams();
+            writer.scope(scopes);
+            bits::detail::writeParams<typename E::ParamTuple>(writer, std::forward<Args>(args)...);
+            _endFrame(writer);
+
+            bool answered = false;
+            json resp = this->_request(E::name(), requestId, frame, &answered);
+            if (!answered || !resp.is_array() || resp.empty()) {
+                return false;
+            }
+            try {
+                result = bits::detail::decodeParam<typename E::ResultType>(resp[0]);
+            } catch(...) {
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * Send a request frame and block until its response arrives. The
+         * response slot and the round trip histogram are set up before
+         * sending so a fast reply cannot be missed and the timed path does
+         * not touch the registry. The result is null, and answered false,
+         * if none arrives or the response carries an error.
+         */
+        json _request(const char *request, const std::string &requestId, const std::string &frame,
+                      bool *answered=nullptr) {
+            std::shared_ptr<bits::Histogram> rtt = _rttHistogram(request);
+            PendingResponse pending;
+            {
+                std::lock_guard<std::mutex> lock(_response_mutex);
+                _pendingResponses.push_back(std::make_pair(requestId, &pending));
+            }
+
+            const Clock::time_point sentAt = Clock::now();
+            bool sent = _write(frame);
+
+            std::unique_lock<std::mutex> lock(_response_mutex);
+            if (sent) {
+                pending.cond.wait(lock, [&] {
+                    return pending.done || _stopEvent;
+                });
+            }
+            _pendingResponses.erase(_findPending(requestId));
+            lock.unlock();
+            if (pending.done) {
+                rtt->record(_elapsedNs(sentAt));
+            }
+            if (answered != nullptr) {
+                *answered = pending.done && !pending.failed;
+            }
+
+            return std::move(pending.result);
+        }
+
+        /**
+         * Round trip histogram of request, interning its name on the first
+         */
+        std::shared_ptr<bits::Histogram> _rttHistogram(const char *request) {
+            {
+                bits::RcuCell<ListenerRegistry>::ReadGuard listeners(_listeners);
+                bits::InternedId id = listeners->requestRtt.find(request, strlen(request));
+                if (id != bits::INVALID_ID) {
+                    return listeners->requestRtt.at(id);
+                }
+            }
+            std::shared_ptr<bits::Histogram> histogram;
+            _listeners.update([&](ListenerRegistry &listeners) {
+                std::shared_ptr<bits::Histogram> &slot =
+                    listeners.requestRtt.at(listeners.requestRtt.intern(request));
+                if (!slot) {
+                    slot = std::make_shared<bits::Histogram>();
+                }
+                histogram = slot;
+            });
+            return histogram;
+        }
+
+        template<typename Listeners>
+        static uint64_t _countListeners(const bits::DispatchTable<Listeners> &table) {
+            uint64_t count = 0;
+            for (bits::InternedId id = 0; id < table.size(); ++id) {
+                count += table.at(id).listeners.size();
+            }
+            return count;
+        }
+
+        static std::string _prometheusLabel(const std::string &value) {
+            std::string label = "\"";
+            for (char c : value) {
+                if (c == '\\' || c == '"') {
+                    label.push_back('\\');
+                    label.push_back(c);
+                } else if (c == '\n') {
+                    label.append("\\n");
+                } else {
+                    label.push_back(c);
+                }
+            }
+            label.push_back('"');
+            return label;
+        }
+
+        static void _prometheusHeader(std::ostream &out, const std::string &name, const char *help) {
+            out << "# HELP " << name << " " << help << "\n"
+                << "# TYPE " << name << " summary\n";
+        }
+
+        /**
+         * One summary series; help is null when the header was written
+         * already
+         */
+        static void _prometheusSummary(std::ostream &out, const std::string &name, const char *help,
+                                       const std::string &labels, const bits::HistogramSnapshot &h) {
+            if (help) {
+                _prometheusHeader(out, name, help);
+            }
+            const std::string sep = labels.empty() ? "" : ",";
+            const struct {
+                const char *quantile;
+                uint64_t value;
+            } quantiles[] = {
+                { "0.5", h.p50 }, { "0.9", h.p90 }, { "0.99", h.p99 }, { "0.999", h.p999 }
+            };
+            for (auto &&q : quantiles) {
+                out << name << "{" << labels << sep << "quantile=\"" << q.quantile << "\"} "
+                    << q.value / 1e9 << "\n";
+            }
+            out << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " "
+                << h.mean * h.count / 1e9 << "\n";
+            out << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " "
+                << h.count << "\n";
+        }
+
+        static uint64_t _elapsedNs(Clock::time_point from, Clock::time_point to=Clock::now()) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+        }
+
+        /**
+         * Nanoseconds on the clock latency stamps use. steady_clock is
+         * CLOCK_MONOTONIC on Linux, as is node's process.hrtime().
+         */
+        static uint64_t _monotonicNs(Clock::time_point t) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+        }
+
+        /**
+         * Record the hops of a received frame's latency stamps, ending
+         * with client-recv (arrival) and client-dispatch (started): each
+         * consecutive pair, and first to last when there are more than
+         * two. Stamps are [hop, nanoseconds] pairs; the bridge sends the
+         * nanoseconds as strings since they do not fit a double.
+         */
+        void _recordHops(const json &msg, Clock::time_point arrival, Clock::time_point started) {
+            auto stamps = msg.find("stamps");
+            if (stamps == msg.end() || !stamps->is_array() || stamps->empty()) {
+                return;
+            }
+
+            bits::InternedId first = bits::INVALID_ID, previous = bits::INVALID_ID;
+            uint64_t firstNs = 0, previousNs = 0;
+            size_t hops = 0;
+            auto hop = [&](bits::InternedId id, uint64_t ns) {
+                if (previous == bits::INVALID_ID) {
+                    first = id;
+                    firstNs = ns;
+                } else {
+                    _hopTimings.record(previous, id, ns > previousNs ? ns - previousNs : 0);
+                }
+                previous = id;
+                previousNs = ns;
+                ++hops;
+            };
+
+            for (auto &&stamp : *stamps) {
+                if (!stamp.is_array() || stamp.size() != 2 || !stamp[0].is_string()) {
+                    return;
+                }
+                const std::string &name = stamp[0].get_ref<const std::string&>();
+                const bits::InternedId id = _hopIndex().find(name);
+                if (id == bits::INVALID_ID) {
+                    continue;
+                }
+                const json &time = stamp[1];
+                hop(id, time.is_string()
+                    ? std::strtoull(time.get_ref<const std::string&>().c_str(), nullptr, 10)
+                    : time.is_number() ? time.get<uint64_t>() : 0);
+            }
+            if (hops == 0) {
+                return;
+            }
+            hop(CLIENT_RECV, _monotonicNs(arrival));
+            hop(CLIENT_DISPATCH, _monotonicNs(started));
+            if (hops > 2) {
+                _hopTimings.record(first, previous, previousNs > firstNs ? previousNs - firstNs : 0);
+            }
+        }
+
+        /**
+         * Perfect hash over HOP_NAMES, built once
+         */
+        static const bits::PerfectHashIndex &_hopIndex() {
+            static const bits::PerfectHashIndex index = [] {
+                bits::PerfectHashIndex built;
+                built.build(std::vector<std::string>(HOP_NAMES, HOP_NAMES + HOP_COUNT));
+                return built;
+            }();
+            return index;
+        }
+
+        /**
+         * Handle an incoming event, passing it to the eventListeners
+         * registered on the frame's scopes. Latest listeners skip it if
+         * it was superseded, filtered listeners if it does not match
+         * their filter (the bridge sends the union of all filters on
+         * this connection) or the bridge did not sample it for them. A callback that
+         * throws, including a typed listener whose params do not decode,
+         * is counted in dispatchErrors and the rest still run.
+         */
+        void _handleEvent(const json &msg, Clock::time_point arrival, bool superseded=false) {
+            const std::string &event = msg["event"].get_ref<const std::string&>();
+            bits::RcuCell<ListenerRegistry>::ReadGuard listeners(_listeners);
+            bits::InternedId id = listeners->events.find(event);
+            if (id != bits::INVALID_ID) {
+                const EventListeners &handlers = listeners->events.at(id);
+                const json &params = msg["params"];
+                Clock::time_point started = Clock::now();
+                handlers.timings->queue.record(_elapsedNs(arrival, started));
+                _recordHops(msg, arrival, started);
+                if (handlers.listeners.empty()) {
+                    _counters.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                }
+                bool skipped = false;
+                for (auto &&entry : handlers.listeners) {
+                    if (!_scopeMatches(msg, entry.scopes)) {
+                        continue;
+                    }
+                    if (superseded && entry.latest) {
+                        skipped = true;
+                        continue;
+                    }
+                    if (entry.tag != 0 && !_sampledFor(msg, entry.tag)) {
+                        continue;
+                    }
+                    if (!entry.filter.empty() && !entry.filter.matches(params)) {
+                        continue;
+                    }
+                    BITS_PROBE2(dispatch_start, "event", event.c_str());
+                    // a throwing callback must not cost the listeners
+                    // after it this event
+                    try {
+                        entry.cb(params);
+                    } catch(...) {
+                        _counters.dispatchErrors.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    Clock::time_point finished = Clock::now();
+                    const uint64_t callbackNs = _elapsedNs(started, finished);
+                    handlers.timings->callback.record(callbackNs);
+                    BITS_PROBE3(dispatch_end, "event", event.c_str(), callbackNs);
+                    started = finished;
+                }
+                if (skipped) {
+                    _counters.supersededEvents.fetch_add(1, std::memory_order_relaxed);
+                }
+            } else {
+                _counters.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Whether the bridge sampled the event frame msg for the
+         * subscription tagged tag. Frames without tags come from a
+         * connection the bridge has no sampled subscription for.
+         */
+        static bool _sampledFor(const json &msg, uint32_t tag) {
+            auto tags = msg.find("tags");
+            if (tags == msg.end() || !tags->is_array()) {
+                return true;
+            }
+            for (auto &&sampled : *tags) {
+                if (sampled.is_number_unsigned() && sampled.get<uint32_t>() == tag) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * The _pendingResponses entry for requestId; call with
+         * _response_mutex held
+         */
+        std::vector< std::pair<RequestIdentifier, PendingResponse*> >::iterator
+        _findPending(const RequestIdentifier &requestId) {
+            return std::find_if(_pendingResponses.begin(), _pendingResponses.end(),
+                [&](const std::pair<RequestIdentifier, PendingResponse*> &pending) {
+                    return pending.first == requestId;
+                });
+        }
+
+        /**
+         * Handle an incoming response, passing it to the responseListener
+         */
+        void _handleResponse(json &msg) {
+            const std::string &responseId = msg["responseId"].get_ref<const std::string&>();
+            std::lock_guard<std::mutex> lock(_response_mutex);
+            auto pending = _findPending(responseId);
+            if (pending != _pendingResponses.end()) {
+                auto err = msg.find("err");
+                pending->second->failed = err != msg.end() && !err->is_null();
+                if (!pending->second->failed) {
+                    pending->second->result = std::move(msg["result"]);
+                }
+                pending->second->done = true;
+                pending->second->cond.notify_one();
+            } else {
+                _counters.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * The most recently added handler registered on the request's
+         * scopes, null if there is none
+         */
+        static const ListenerEntry<RequestListener> *_requestHandler(
+            const RequestListeners &handlers, const json &msg
+        ) {
+            for (auto it = handlers.listeners.rbegin(); it != handlers.listeners.rend(); ++it) {
+                if (_scopeMatches(msg, it->scopes)) {
+                    return &*it;
+                }
+            }
+            return nullptr;
+        }
+
+        /**
+         * Handle an incoming request, passing it to the requestListener
+         * registered on its scopes. A request without one, or whose
+         * handler throws (including a typed handler whose params do not
+         * decode), is answered with an error.
+         */
+        void _handleRequest(const json &msg, Clock::time_point arrival) {
+            const std::string &event = msg["event"].get_ref<const std::string&>();
+            const json &requestId = msg["requestId"];
+            bits::RcuCell<ListenerRegistry>::ReadGuard listeners(_listeners);
+            bits::InternedId id = listeners->requests.find(event);
+            const ListenerEntry<RequestListener> *handler = id != bits::INVALID_ID
+                ? _requestHandler(listeners->requests.at(id), msg) : nullptr;
+            if (handler != nullptr) {
+                const RequestListeners &handlers = listeners->requests.at(id);
+                const Clock::time_point started = Clock::now();
+                handlers.timings->queue.record(_elapsedNs(arrival, started));
+                _recordHops(msg, arrival, started);
+                BITS_PROBE2(dispatch_start, "request", event.c_str());
+                json result;
+                bool failed = false;
+                try {
+                    result = handler->cb(msg["params"]);
+                } catch(...) {
+                    // answer anyway, or the bridge holds the request until
+                    // it times out
+                    _counters.dispatchErrors.fetch_add(1, std::memory_order_relaxed);
+                    failed = true;
+                }
+                const uint64_t callbackNs = _elapsedNs(started);
+                handlers.timings->callback.record(callbackNs);
+                BITS_PROBE3(dispatch_end, "request", event.c_str(), callbackNs);
+
+                if (failed) {
+                    _respondError(event, requestId, "request handler failed");
+                } else {
+                    _respond(event, requestId, result);
+                }
+            } else {
+                // e.g. in flight while its handler was removed: fail it
+                // so the bridge can pass it to another worker at once
+                _counters.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                _respondError(event, requestId, "no request handler on these scopes", true);
+            }
+        }
+
+        /**
+         * Send the response to a request
+         */
+        void _respond(const std::string &event, const json &requestId, const json &result) {
+            std::string &frame = _frameBuffer();
+            bits::FrameWriter writer(frame);
+            writer.beginFrame("response", event);
+            writer.member("responseId", requestId);
+            writer.beginParams();
+            writer.param(result);
+            _endFrame(writer);
+
+            this->_write(frame);
+        }
+
+        /**
+         * Fail a request; the bridge rejects the BITS request with err,
+         * or passes an unhandled one to another worker of its group
+         */
+        void _respondError(const std::string &event, const json &requestId, const char *err,
+                           bool unhandled=false) {
+            std::string &frame = _frameBuffer();
+            bits::FrameWriter writer(frame);
+            writer.beginFrame("response", event);
+            writer.member("responseId", requestId);
+            writer.member("err", err);
+            if (unhandled) {
+                writer.member("unhandled", true);
+            }
+            writer.beginParams();
+            _endFrame(writer);
+
+            this->_write(frame);
+        }
+
+        /**
+         * Prevent copy
+         */
+        MessageCenter(const MessageCenter&) {
+        }
+
+        /**
+         * Prevent assignment
+         */
+        MessageCenter& operator=(MessageCenter) {
+            return *this;
+        }
+
+};
+
+constexpr const char *MessageCenter::HOP_NAMES[MessageCenter::HOP_COUNT];
 
 #endif
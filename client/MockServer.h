@@ -0,0 +1,558 @@
+#ifndef MOCK_SERVER_H
+#define MOCK_SERVER_H
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json.hpp"
+#include "FrameWriter.h"
+
+namespace bits {
+
+/*
+ * Stand-in for the bits-node-ipc bridge, so MessageCenter can be run and
+ * benchmarked without a BITS install. It speaks the same bits-ipc
+ * envelope and '\f' framing and behaves like the bridge in front of an
+ * otherwise empty BITS:
+ *
+ *   - events are fanned out to every client subscribed to them
+ *   - requests go to a client serving them if there is one, and are
+ *     echoed back otherwise (base#System bitsId answers the system id)
+ *   - configured event streams are published at a fixed rate
+ *   - bits-ipc#heartbeat events and bits-ipc#ping requests are sent
+ *     periodically when enabled
+ *   - latency stamps on events and requests are passed on with
+ *     bridge-recv and bridge-send hops added
+ *
+ * Scopes are accepted but ignored. Everything runs on one poll() thread.
+ */
+class MockServer {
+    public:
+        typedef nlohmann::json json;
+
+        struct Stats {
+            uint64_t connections;
+            uint64_t framesIn;
+            uint64_t framesOut;
+            uint64_t bytesIn;
+            uint64_t bytesOut;
+            uint64_t events;
+            uint64_t requests;
+            uint64_t pongs;
+        };
+
+        explicit MockServer(const std::string &socket_path) :
+            _socket_path(socket_path),
+            _systemId("mock") {}
+
+        ~MockServer() {
+            stop();
+        }
+
+        /**
+         * Publish event at rate per second with a string payload of
+         * payloadBytes; params are [sequence, milliseconds since epoch,
+         * payload]. Set up before start().
+         */
+        void addStream(const std::string &event, double rate, size_t payloadBytes=0) {
+            Stream stream;
+            stream.event = event;
+            stream.rate = rate;
+            stream.payload.assign(payloadBytes, 'x');
+            stream.sent = 0;
+            _streams.push_back(stream);
+        }
+
+        void setHeartbeatInterval(unsigned int ms) {
+            _heartbeatMs = ms;
+        }
+
+        void setPingInterval(unsigned int ms) {
+            _pingMs = ms;
+        }
+
+        void setSystemId(const std::string &systemId) {
+            _systemId = systemId;
+        }
+
+        /**
+         * Bind the socket and start serving on a background thread
+         */
+        bool start() {
+            if ((_listenFd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+                perror("socket error");
+                return false;
+            }
+
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, _socket_path.c_str(), sizeof(addr.sun_path)-1);
+            unlink(_socket_path.c_str());
+
+            if (bind(_listenFd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+                listen(_listenFd, 64) == -1) {
+                perror("bind error");
+                close(_listenFd);
+                _listenFd = -1;
+                return false;
+            }
+
+            _stopEvent = false;
+            _thread = std::thread([this] { this->_run(); });
+            return true;
+        }
+
+        void stop() {
+            _stopEvent = true;
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+            for (auto &&client : _clients) {
+                close(client.second.fd);
+            }
+            _clients.clear();
+            if (_listenFd != -1) {
+                close(_listenFd);
+                unlink(_socket_path.c_str());
+                _listenFd = -1;
+            }
+        }
+
+        Stats stats() const {
+            Stats stats = {
+                _connections.load(), _framesIn.load(), _framesOut.load(),
+                _bytesIn.load(), _bytesOut.load(), _events.load(),
+                _requests.load(), _pongs.load()
+            };
+            return stats;
+        }
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Stream {
+            std::string event;
+            double rate;
+            std::string payload;
+            uint64_t sent;
+        };
+
+        struct Client {
+            int fd;
+            std::string buffer;
+            std::multiset<std::string> events;
+            std::multiset<std::string> requests;
+        };
+
+        // request forwarded to a serving client, by the id it was sent with
+        struct Forwarded {
+            uint64_t client;
+            json requestId;
+        };
+
+        std::string _socket_path;
+        std::string _systemId;
+        int _listenFd = -1;
+        std::thread _thread;
+        std::atomic<bool> _stopEvent;
+
+        std::vector<Stream> _streams;
+        unsigned int _heartbeatMs = 0;
+        unsigned int _pingMs = 0;
+
+        std::map<uint64_t, Client> _clients;
+        uint64_t _lastClientId = 0;
+        std::map<std::string, Forwarded> _forwarded;
+        uint64_t _lastRequestId = 0;
+
+        std::atomic<uint64_t> _connections{0};
+        std::atomic<uint64_t> _framesIn{0};
+        std::atomic<uint64_t> _framesOut{0};
+        std::atomic<uint64_t> _bytesIn{0};
+        std::atomic<uint64_t> _bytesOut{0};
+        std::atomic<uint64_t> _events{0};
+        std::atomic<uint64_t> _requests{0};
+        std::atomic<uint64_t> _pongs{0};
+
+        void _run() {
+            const Clock::time_point started = Clock::now();
+            Clock::time_point lastHeartbeat = started;
+            Clock::time_point lastPing = started;
+            std::vector<struct pollfd> fds;
+            std::vector<uint64_t> ids;
+
+            while (!_stopEvent) {
+                fds.clear();
+                ids.clear();
+                fds.push_back({ _listenFd, POLLIN, 0 });
+                for (auto &&client : _clients) {
+                    fds.push_back({ client.second.fd, POLLIN, 0 });
+                    ids.push_back(client.first);
+                }
+
+                if (poll(fds.data(), fds.size(), 1) > 0) {
+                    if (fds[0].revents & POLLIN) {
+                        _accept();
+                    }
+                    for (size_t i = 1; i < fds.size(); ++i) {
+                        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                            _read(ids[i - 1]);
+                        }
+                    }
+                }
+
+                const Clock::time_point now = Clock::now();
+                const double elapsed = std::chrono::duration<double>(now - started).count();
+                for (auto &&stream : _streams) {
+                    while (stream.sent < static_cast<uint64_t>(elapsed * stream.rate)) {
+                        _publishStream(stream);
+                    }
+                }
+                if (_heartbeatMs > 0 && now - lastHeartbeat >= std::chrono::milliseconds(_heartbeatMs)) {
+                    lastHeartbeat = now;
+                    _heartbeat();
+                }
+                if (_pingMs > 0 && now - lastPing >= std::chrono::milliseconds(_pingMs)) {
+                    lastPing = now;
+                    _ping();
+                }
+            }
+        }
+
+        void _accept() {
+            int fd = accept(_listenFd, nullptr, nullptr);
+            if (fd == -1) {
+                return;
+            }
+            Client client;
+            client.fd = fd;
+            _clients[++_lastClientId] = client;
+            ++_connections;
+        }
+
+        void _disconnect(uint64_t id) {
+            auto found = _clients.find(id);
+            if (found != _clients.end()) {
+                close(found->second.fd);
+                _clients.erase(found);
+            }
+        }
+
+        void _read(uint64_t id) {
+            // a write earlier in this poll round may have dropped it
+            auto found = _clients.find(id);
+            if (found == _clients.end()) {
+                return;
+            }
+
+            char buf[65536];
+            ssize_t rc = read(found->second.fd, buf, sizeof(buf));
+            if (rc <= 0) {
+                _disconnect(id);
+                return;
+            }
+            _bytesIn += rc;
+
+            std::string &buffer = found->second.buffer;
+            buffer.append(buf, rc);
+            size_t start = 0;
+            size_t idx;
+            while ((idx = buffer.find('\f', start)) != std::string::npos) {
+                std::string frame = buffer.substr(start, idx - start);
+                start = idx + 1;
+                ++_framesIn;
+                try {
+                    _handle(id, _member(json::parse(frame), "data"));
+                } catch (...) {
+                    continue;
+                }
+                if (_clients.count(id) == 0) {
+                    return;
+                }
+            }
+            buffer.erase(0, start);
+        }
+
+        /**
+         * Write a complete frame, terminated with the delimiter
+         */
+        bool _write(uint64_t id, const std::string &frame) {
+            auto found = _clients.find(id);
+            if (found == _clients.end()) {
+                return false;
+            }
+            size_t offset = 0;
+            while (offset < frame.size()) {
+                ssize_t rc = send(found->second.fd, frame.data() + offset,
+                                  frame.size() - offset, MSG_NOSIGNAL);
+                if (rc == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (rc <= 0) {
+                    _disconnect(id);
+                    return false;
+                }
+                offset += rc;
+            }
+            _bytesOut += frame.size();
+            ++_framesOut;
+            return true;
+        }
+
+        void _handle(uint64_t id, const json &data) {
+            // const operator[] asserts on a missing key, so check first
+            const json &typeMember = _member(data, "type");
+            const json &eventMember = _member(data, "event");
+            if (!typeMember.is_string() || !eventMember.is_string()) {
+                return;
+            }
+            const std::string &type = typeMember.get_ref<const std::string&>();
+            const std::string &event = eventMember.get_ref<const std::string&>();
+            Client &client = _clients[id];
+
+            if (type == "event") {
+                ++_events;
+                _publish(event, _withoutScope(_member(data, "params")), _stamp(data, "bridge-recv"));
+            } else if (type == "request") {
+                ++_requests;
+                _request(id, event, data);
+            } else if (type == "response") {
+                _response(event, data);
+            } else if (type == "addEventListener") {
+                client.events.insert(event);
+            } else if (type == "removeEventListener") {
+                _eraseOne(client.events, event);
+            } else if (type == "addRequestListener") {
+                client.requests.insert(event);
+            } else if (type == "removeRequestListener") {
+                _eraseOne(client.requests, event);
+            }
+        }
+
+        /**
+         * data[key], or null if data is not an object or has no key
+         */
+        static const json &_member(const json &data, const char *key) {
+            static const json missing;
+            if (!data.is_object()) {
+                return missing;
+            }
+            auto found = data.find(key);
+            return found != data.end() ? *found : missing;
+        }
+
+        /**
+         * Listeners see the params after the leading scope object, as
+         * BITS passes them
+         */
+        static json _withoutScope(const json &params) {
+            json args = json::array();
+            for (size_t i = 1; i < params.size(); ++i) {
+                args.push_back(params[i]);
+            }
+            return args;
+        }
+
+        /**
+         * The frame's latency stamps with hop appended, or null if it
+         * carries none
+         */
+        static json _stamp(const json &data, const char *hop) {
+            auto stamps = data.find("stamps");
+            if (stamps == data.end() || !stamps->is_array()) {
+                return nullptr;
+            }
+            return _appendStamp(*stamps, hop);
+        }
+
+        /**
+         * Stamps are [hop, nanoseconds on CLOCK_MONOTONIC as a string]
+         */
+        static json _appendStamp(json stamps, const char *hop) {
+            const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now().time_since_epoch()).count();
+            stamps.push_back({ hop, std::to_string(ns) });
+            return stamps;
+        }
+
+        static void _eraseOne(std::multiset<std::string> &set, const std::string &value) {
+            auto found = set.find(value);
+            if (found != set.end()) {
+                set.erase(found);
+            }
+        }
+
+        void _publish(const std::string &event, const json &params,
+                      const json &stamps=nullptr) {
+            std::string frame;
+            FrameWriter writer(frame);
+            writer.beginFrame("event", event);
+            writer.beginParams();
+            for (auto &&param : params) {
+                writer.param(param);
+            }
+            _endFrame(writer, stamps);
+            frame.push_back('\f');
+            _broadcast(event, frame);
+        }
+
+        void _broadcast(const std::string &event, const std::string &frame) {
+            std::vector<uint64_t> targets;
+            for (auto &&client : _clients) {
+                if (client.second.events.count(event) > 0) {
+                    targets.push_back(client.first);
+                }
+            }
+            for (uint64_t target : targets) {
+                _write(target, frame);
+            }
+        }
+
+        void _request(uint64_t id, const std::string &event, const json &data) {
+            const json args = _withoutScope(_member(data, "params"));
+            const json &requestId = _member(data, "requestId");
+
+            // the most recent client to serve the request handles it
+            for (auto it = _clients.rbegin(); it != _clients.rend(); ++it) {
+                if (it->second.requests.count(event) == 0) {
+                    continue;
+                }
+                std::string forwardedId = "mock-" + std::to_string(++_lastRequestId);
+                _forwarded[forwardedId] = { id, requestId };
+                _sendRequest(it->first, event, forwardedId, args, _stamp(data, "bridge-recv"));
+                return;
+            }
+
+            json result;
+            if (event == "base#System bitsId") {
+                result = _systemId;
+            } else if (args.size() == 1) {
+                result = args[0];
+            } else if (args.size() > 1) {
+                result = args;
+            }
+            _respond(id, event, requestId, json::array({ result }));
+        }
+
+        void _sendRequest(uint64_t id, const std::string &event,
+                          const std::string &requestId, const json &args,
+                          const json &stamps=nullptr) {
+            std::string frame;
+            FrameWriter writer(frame);
+            writer.beginFrame("request", event);
+            writer.member("requestId", requestId);
+            writer.beginParams();
+            for (auto &&arg : args) {
+                writer.param(arg);
+            }
+            _endFrame(writer, stamps);
+            frame.push_back('\f');
+            _write(id, frame);
+        }
+
+        /**
+         * Close a frame, adding the bridge-send stamp if it is stamped
+         */
+        static void _endFrame(FrameWriter &writer, const json &stamps) {
+            if (stamps.is_null()) {
+                writer.endFrame();
+                return;
+            }
+            writer.endFrame(_appendStamp(stamps, "bridge-send"));
+        }
+
+        void _respond(uint64_t id, const std::string &event,
+                      const json &requestId, const json &result,
+                      const json &err=nullptr) {
+            json resp;
+            resp["type"] = "bits-ipc";
+            resp["data"] = {
+                { "type", "response" },
+                { "event", event },
+                { "responseId", requestId },
+                { "err", err },
+                { "result", err.is_null() ? result : json() }
+            };
+            _write(id, resp.dump() + "\f");
+        }
+
+        void _response(const std::string &event, const json &data) {
+            const json &responseIdMember = _member(data, "responseId");
+            if (!responseIdMember.is_string()) {
+                return;
+            }
+            const std::string &responseId = responseIdMember.get_ref<const std::string&>();
+            if (responseId.compare(0, 10, "mock-ping-") == 0) {
+                ++_pongs;
+                return;
+            }
+
+            auto found = _forwarded.find(responseId);
+            if (found == _forwarded.end()) {
+                return;
+            }
+            Forwarded forwarded = found->second;
+            _forwarded.erase(found);
+            // a failed handler's err is passed on, as the bridge rejects
+            auto err = data.find("err");
+            _respond(forwarded.client, event, forwarded.requestId, _member(data, "params"),
+                     err != data.end() ? *err : json());
+        }
+
+        void _publishStream(Stream &stream) {
+            std::string frame;
+            FrameWriter writer(frame);
+            writer.beginFrame("event", stream.event);
+            writer.beginParams();
+            writer.param(stream.sent++);
+            writer.param(_nowMs());
+            writer.param(stream.payload);
+            writer.endFrame();
+            frame.push_back('\f');
+            _broadcast(stream.event, frame);
+        }
+
+        void _heartbeat() {
+            _publish("bits-ipc#heartbeat", json::array({ _nowMs() }));
+        }
+
+        void _ping() {
+            std::vector<uint64_t> targets;
+            for (auto &&client : _clients) {
+                if (client.second.requests.count("bits-ipc#ping") > 0) {
+                    targets.push_back(client.first);
+                }
+            }
+            for (uint64_t target : targets) {
+                _sendRequest(target, "bits-ipc#ping",
+                             "mock-ping-" + std::to_string(++_lastRequestId),
+                             json::array({ _nowMs() }));
+            }
+        }
+
+        static int64_t _nowMs() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        MockServer(const MockServer &);
+        MockServer &operator=(const MockServer &);
+};
+
+} // namespace bits
+
+#endif
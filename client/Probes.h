@@ -0,0 +1,38 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * Static tracepoints (USDT) on the MessageCenter hot paths, provider
+ * bits_ipc. With <sys/sdt.h> available (systemtap-sdt-dev on Debian,
+ * systemtap-sdt-devel on Fedora) each probe compiles to a single nop plus
+ * an ELF note, so bpftrace or perf can attach to a running process and
+ * nothing is paid while nobody does. Without the header, or with
+ * BITS_IPC_NO_PROBES defined, the probes compile to nothing.
+ *
+ *   frame_read(const char *frame, size_t bytes)
+ *   parse_done(const char *frame, size_t bytes, int ok)
+ *   dispatch_start(const char *type, const char *name)
+ *   dispatch_end(const char *type, const char *name, uint64_t callbackNs)
+ *   send_enqueue(const char *frame, size_t bytes)
+ *   send_done(size_t bytes, int ok)
+ *
+ * Probe arguments are evaluated even while nobody is tracing, so keep
+ * them to values that are already at hand.
+ */
+
+#if !defined(BITS_IPC_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BITS_IPC_PROBES 1
+#endif
+#endif
+
+#ifdef BITS_IPC_PROBES
+#define BITS_PROBE2(name, a, b) DTRACE_PROBE2(bits_ipc, name, a, b)
+#define BITS_PROBE3(name, a, b, c) DTRACE_PROBE3(bits_ipc, name, a, b, c)
+#else
+#define BITS_PROBE2(name, a, b) do {} while (0)
+#define BITS_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif
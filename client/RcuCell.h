@@ -0,0 +1,113 @@
+#ifndef RCU_CELL_H
+#define RCU_CELL_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace bits {
+
+/*
+ * Read-copy-update holder for a value that is read on every message but
+ * changed rarely. Readers pin the current version with a ReadGuard (one
+ * atomic increment, no lock). Writers copy the current version, modify
+ * the copy and publish it with a single atomic exchange; replaced
+ * versions are freed once no reader is inside a guard, by the writer or
+ * else by the last guard to be released.
+ */
+template<typename T>
+class RcuCell {
+    public:
+        /*
+         * Pins the version that was current when the guard was created
+         */
+        class ReadGuard {
+            public:
+                explicit ReadGuard(const RcuCell &cell) : _cell(cell) {
+                    _cell._readers.fetch_add(1);
+                    _value = _cell._current.load();
+                }
+
+                ~ReadGuard() {
+                    if (_cell._readers.fetch_sub(1) == 1 && _cell._hasRetired.load()) {
+                        const_cast<RcuCell&>(_cell)._tryReclaim();
+                    }
+                }
+
+                const T &operator*() const {
+                    return *_value;
+                }
+
+                const T *operator->() const {
+                    return _value;
+                }
+
+            private:
+                const RcuCell &_cell;
+                const T *_value;
+
+                ReadGuard(const ReadGuard &);
+                ReadGuard &operator=(const ReadGuard &);
+        };
+
+        RcuCell() : _current(new T()), _readers(0), _hasRetired(false) {}
+
+        ~RcuCell() {
+            delete _current.load();
+            _reclaim();
+        }
+
+        /**
+         * Apply fn to a copy of the current version and publish the copy.
+         * Writers are serialized; readers are never blocked.
+         */
+        template<typename Fn>
+        void update(Fn fn) {
+            std::lock_guard<std::mutex> lock(_write_mutex);
+
+            T *next = new T(*_current.load());
+            fn(*next);
+            _retired.push_back(_current.exchange(next));
+            _hasRetired = true;
+
+            // Any reader that starts after the exchange sees 'next', so if
+            // nobody is inside a guard now the retired versions are unused.
+            if (_readers.load() == 0) {
+                _reclaim();
+            }
+        }
+
+    private:
+        std::atomic<const T*> _current;
+        mutable std::atomic<unsigned int> _readers;
+        std::mutex _write_mutex;
+        std::vector<const T*> _retired;
+        std::atomic<bool> _hasRetired;
+
+        /**
+         * Free the retired versions if no reader is inside a guard. Called
+         * by the last guard released, which must not block on a writer:
+         * if one holds the lock, it or a later guard reclaims instead.
+         */
+        void _tryReclaim() {
+            std::unique_lock<std::mutex> lock(_write_mutex, std::try_to_lock);
+            if (lock.owns_lock() && _readers.load() == 0) {
+                _reclaim();
+            }
+        }
+
+        void _reclaim() {
+            for (const T *old : _retired) {
+                delete old;
+            }
+            _retired.clear();
+            _hasRetired = false;
+        }
+
+        RcuCell(const RcuCell &);
+        RcuCell &operator=(const RcuCell &);
+};
+
+} // namespace bits
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef TYPED_MESSAGES_H
+#define TYPED_MESSAGES_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+#include "json.hpp"
+#include "FrameWriter.h"
+
+namespace bits {
+
+namespace detail {
+
+/*
+ * How a typed callback receives a param: scalars by value, everything
+ * else by const reference so strings and json are passed straight from
+ * the parsed frame instead of being copied
+ */
+template<typename T>
+struct ParamRef {
+    typedef typename std::conditional<
+        std::is_arithmetic<T>::value, T, const T&>::type type;
+};
+
+} // namespace detail
+
+/*
+ * Compile-time event descriptor. Derive from it and name the event:
+ *
+ *   struct SensorSample : bits::Event<double, int64_t> {
+ *       static const char *name() { return "sensor#sample"; }
+ *   };
+ *
+ * or use BITS_EVENT(SensorSample, "sensor#sample", double, int64_t).
+ * MessageCenter::sendEvent<E>() and addEventListener<E>() then only
+ * accept the declared parameter list. Listeners are called with
+ * non-scalar params as const references into the parsed frame.
+ */
+template<typename... Params>
+struct Event {
+    typedef std::tuple<Params...> ParamTuple;
+    typedef std::function<void(typename detail::ParamRef<Params>::type...)> Callback;
+    static const size_t arity = sizeof...(Params);
+};
+
+/*
+ * Compile-time request descriptor, see Event.
+ *
+ *   BITS_REQUEST(Ping, "bits-ipc#ping", nlohmann::json, int64_t);
+ */
+template<typename Result, typename... Params>
+struct Request {
+    typedef Result ResultType;
+    typedef std::tuple<Params...> ParamTuple;
+    typedef std::function<Result(typename detail::ParamRef<Params>::type...)> Handler;
+    static const size_t arity = sizeof...(Params);
+};
+
+#define BITS_EVENT(Type, Name, ...)                                 \
+    struct Type : ::bits::Event<__VA_ARGS__> {                      \
+        static const char *name() { return Name; }                  \
+    }
+
+#define BITS_REQUEST(Type, Name, ...)                               \
+    struct Type : ::bits::Request<__VA_ARGS__> {                    \
+        static const char *name() { return Name; }                  \
+    }
+
+namespace detail {
+
+/*
+ * SFINAE guard: Require<typename E::Callback, R>::type only exists for
+ * event descriptors, so typed overloads drop out for everything else
+ */
+template<typename Member, typename R>
+struct Require {
+    typedef R type;
+};
+
+/*
+ * C++11 stand-in for std::index_sequence
+ */
+template<size_t... Is>
+struct Indices {};
+
+template<size_t N, size_t... Is>
+struct BuildIndices : BuildIndices<N - 1, N - 1, Is...> {};
+
+template<size_t... Is>
+struct BuildIndices<0, Is...> {
+    typedef Indices<Is...> type;
+};
+
+/*
+ * True when every Arg converts to the matching Param
+ */
+template<typename Params, typename... Args>
+struct ArgsMatch;
+
+template<>
+struct ArgsMatch< std::tuple<> > : std::true_type {};
+
+template<typename P, typename... Ps, typename A, typename... As>
+struct ArgsMatch< std::tuple<P, Ps...>, A, As... > :
+    std::integral_constant<bool,
+        std::is_convertible<A, P>::value &&
+        ArgsMatch< std::tuple<Ps...>, As... >::value> {};
+
+template<typename P, typename... Ps>
+struct ArgsMatch< std::tuple<P, Ps...> > : std::false_type {};
+
+template<typename A, typename... As>
+struct ArgsMatch< std::tuple<>, A, As... > : std::false_type {};
+
+template<typename Tuple>
+struct TupleTail;
+
+template<typename P, typename... Ps>
+struct TupleTail< std::tuple<P, Ps...> > {
+    typedef std::tuple<Ps...> type;
+};
+
+/*
+ * Write args into the open params array, each one converted to the
+ * matching Params element first
+ */
+template<typename Params>
+void writeParams(FrameWriter &) {}
+
+template<typename Params, typename A, typename... As>
+void writeParams(FrameWriter &writer, A &&arg, As&&... rest) {
+    typedef typename std::tuple_element<0, Params>::type P;
+    writer.param(static_cast<const typename std::decay<P>::type &>(arg));
+    writeParams<typename TupleTail<Params>::type>(writer, std::forward<As>(rest)...);
+}
+
+template<typename T>
+T decodeParam(const nlohmann::json &j) {
+    return j.get<T>();
+}
+
+template<>
+inline nlohmann::json decodeParam<nlohmann::json>(const nlohmann::json &j) {
+    return j;
+}
+
+/*
+ * Decode a param for a callback: by value, or as a reference into j for
+ * strings and json. Throws if j does not hold a T.
+ */
+template<typename T>
+struct ParamDecoder {
+    static T decode(const nlohmann::json &j) {
+        return j.get<T>();
+    }
+};
+
+template<>
+struct ParamDecoder<std::string> {
+    static const std::string &decode(const nlohmann::json &j) {
+        return j.get_ref<const std::string&>();
+    }
+};
+
+template<>
+struct ParamDecoder<nlohmann::json> {
+    static const nlohmann::json &decode(const nlohmann::json &j) {
+        return j;
+    }
+};
+
+/*
+ * Call fn with params[Offset + i] converted to the i-th element of Params
+ */
+template<typename R, size_t Offset, typename Params, typename Fn, size_t... Is>
+R applyParams(const Fn &fn, const nlohmann::json &params, Indices<Is...>) {
+    return fn(ParamDecoder<typename std::decay<
+        typename std::tuple_element<Is, Params>::type>::type>::decode(params.at(Offset + Is))...);
+}
+
+template<typename R, size_t Offset, typename Params, typename Fn>
+R applyParams(const Fn &fn, const nlohmann::json &params) {
+    return applyParams<R, Offset, Params>(fn, params,
+        typename BuildIndices<std::tuple_size<Params>::value>::type());
+}
+
+} // namespace detail
+
+} // namespace bits
+
+#endif
@@ -0,0 +1,351 @@
+#include "MessageCenter.h"
+#include "MockServer.h"
+
+#include <sys/wait.h>
+#include <signal.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+/*
+ * Every heap allocation made by this process while counting is on. The
+ * mock server runs in a child process so only the client is counted:
+ * the calling thread and the MessageCenter reader thread.
+ */
+static atomic<bool> counting(false);
+static atomic<uint64_t> allocations(0);
+
+/*
+ * Every replaceable allocation function goes through these two. They
+ * are kept out of line: once GCC inlines free() into a caller holding
+ * a pointer from new it warns about the mismatch (-Wmismatched-new-delete),
+ * although new and delete here are a malloc/free pair.
+ */
+__attribute__((noinline)) static void *allocate(size_t size, size_t alignment) {
+    if (counting.load(memory_order_relaxed)) {
+        allocations.fetch_add(1, memory_order_relaxed);
+    }
+    if (size == 0) {
+        size = 1;
+    }
+    if (alignment <= alignof(max_align_t)) {
+        return malloc(size);
+    }
+    void *p = nullptr;
+    return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+}
+
+__attribute__((noinline)) static void release(void *p) {
+    free(p);
+}
+
+static void *allocateOrThrow(size_t size, size_t alignment) {
+    void *p = allocate(size, alignment);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(size_t size) {
+    return allocateOrThrow(size, 0);
+}
+
+void *operator new[](size_t size) {
+    return allocateOrThrow(size, 0);
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept {
+    return allocate(size, 0);
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept {
+    return allocate(size, 0);
+}
+
+void operator delete(void *p) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, const nothrow_t &) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, const nothrow_t &) noexcept {
+    release(p);
+}
+
+#ifdef __cpp_aligned_new
+void *operator new(size_t size, align_val_t alignment) {
+    return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, align_val_t alignment) {
+    return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void *operator new(size_t size, align_val_t alignment, const nothrow_t &) noexcept {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, align_val_t alignment, const nothrow_t &) noexcept {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *p, align_val_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, align_val_t) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, size_t, align_val_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, size_t, align_val_t) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, align_val_t, const nothrow_t &) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, align_val_t, const nothrow_t &) noexcept {
+    release(p);
+}
+#endif
+
+BITS_EVENT(AllocEvent, "alloc#event", int64_t, double, std::string);
+BITS_REQUEST(AllocEcho, "alloc#echo", int64_t, int64_t);
+BITS_REQUEST(AllocHandle, "alloc#handle", int64_t, int64_t);
+
+// a payload past the small string buffer, as real payloads are
+static const string PAYLOAD(64, 'x');
+
+/*
+ * Allocations per message allowed once warmed up. These are what each
+ * path allocates today, not a target: they only guard against changes
+ * that add allocations. Sending does not allocate at all; what is left on
+ * the receive side is the json DOM of each parsed frame (17 for the
+ * event, 15 for a response); typed listeners get strings by reference
+ * into it. A request this client serves itself costs the request's DOM,
+ * its round trip's response and the handler's result on top. A change
+ * that removes allocations should lower the budget with it.
+ */
+static map<string, double> budgets = {
+    { "sendEvent-typed", 0 },
+    { "sendEvent-json", 0 },
+    { "sendRequest-typed", 15 },
+    { "sendRequest-json", 15 },
+    { "dispatch-typed", 17 },
+    { "dispatch-json", 17 },
+    { "request-handler", 29 }
+};
+
+struct Result {
+    uint64_t messages;
+    uint64_t allocations;
+};
+
+/**
+ * Allocations over messages calls of fn, after warmup calls that are
+ * not counted
+ */
+template<typename Fn>
+static Result measure(uint64_t warmup, uint64_t messages, Fn fn) {
+    for (uint64_t i = 0; i < warmup; ++i) {
+        fn(i);
+    }
+    allocations = 0;
+    counting = true;
+    for (uint64_t i = 0; i < messages; ++i) {
+        fn(i);
+    }
+    counting = false;
+    Result r = { messages, allocations.load() };
+    return r;
+}
+
+/**
+ * Allocations of the reader thread dispatching events: the client
+ * subscribes to its own event with subscribe(center, received), the
+ * server echoes every one back, and counting stops once all of them were
+ * dispatched. Sending is allocation free (see sendEvent-typed), so
+ * everything counted is receive side.
+ */
+template<typename Subscribe>
+static Result measureDispatch(MessageCenter &center, uint64_t warmup, uint64_t messages,
+                              Subscribe subscribe) {
+    atomic<uint64_t> received(0);
+    MessageCenter::Subscription subscription = subscribe(center, received);
+    // the subscription is in place once a request made after it returns
+    int64_t echoed = 0;
+    center.sendRequest<AllocEcho>(echoed, 0);
+
+    auto send = [&](uint64_t count) {
+        const uint64_t target = received + count;
+        for (uint64_t i = 0; i < count; ++i) {
+            center.sendEvent<AllocEvent>(static_cast<int64_t>(i), 0.5, PAYLOAD);
+        }
+        while (received < target) {
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    };
+
+    send(warmup);
+    allocations = 0;
+    counting = true;
+    send(messages);
+    counting = false;
+    Result r = { messages, allocations.load() };
+    return r;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ./alloc_check [--messages N] [--budget SCENARIO=ALLOCS]...\n");
+}
+
+/**
+ * Usage: ./alloc_check [--messages N] [--budget SCENARIO=ALLOCS]...
+ *
+ * Counts heap allocations per message on the MessageCenter hot paths
+ * against a forked MockServer and fails (exit 1) when a scenario goes
+ * over its budget, so allocation regressions show up in `make check`.
+ */
+int main(int argc, char *argv[]) {
+    uint64_t messages = 20000;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--messages" && i + 1 < argc) {
+            messages = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--budget" && i + 1 < argc) {
+            string budget = argv[++i];
+            size_t eq = budget.find('=');
+            if (eq == string::npos || budgets.count(budget.substr(0, eq)) == 0) {
+                usage();
+                exit(-1);
+            }
+            budgets[budget.substr(0, eq)] = strtod(budget.c_str() + eq + 1, nullptr);
+        } else {
+            usage();
+            exit(-1);
+        }
+    }
+
+    const string path = "/tmp/bits-alloc." + to_string(getpid());
+    pid_t server = fork();
+    if (server == 0) {
+        bits::MockServer mock(path);
+        if (!mock.start()) {
+            _exit(1);
+        }
+        pause();
+        _exit(0);
+    }
+
+    // wait for the server's socket rather than retrying connect()
+    for (int attempt = 0; access(path.c_str(), F_OK) != 0; ++attempt) {
+        if (attempt == 100) {
+            fprintf(stderr, "failed to connect to %s\n", path.c_str());
+            kill(server, SIGTERM);
+            exit(-1);
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    MessageCenter center(path);
+    if (!center.start()) {
+        fprintf(stderr, "failed to connect to %s\n", path.c_str());
+        kill(server, SIGTERM);
+        exit(-1);
+    }
+    // requests must be answered before anything is measured
+    int64_t echoed = 0;
+    if (!center.sendRequest<AllocEcho>(echoed, 0)) {
+        fprintf(stderr, "no response from %s\n", path.c_str());
+        kill(server, SIGTERM);
+        exit(-1);
+    }
+
+    const uint64_t warmup = messages / 10 + 1;
+    map<string, Result> results;
+
+    results["sendEvent-typed"] = measure(warmup, messages, [&](uint64_t i) {
+        center.sendEvent<AllocEvent>(static_cast<int64_t>(i), 0.5, PAYLOAD);
+    });
+    results["sendEvent-json"] = measure(warmup, messages, [&](uint64_t i) {
+        center.sendEvent("alloc#event", {}, i, 0.5, PAYLOAD);
+    });
+    const uint64_t requests = messages / 10 + 1;
+    results["sendRequest-typed"] = measure(warmup / 10 + 1, requests, [&](uint64_t i) {
+        center.sendRequest<AllocEcho>(echoed, static_cast<int64_t>(i));
+    });
+    results["sendRequest-json"] = measure(warmup / 10 + 1, requests, [&](uint64_t i) {
+        center.sendRequest("alloc#echo", {}, i);
+    });
+
+    // the server routes alloc#handle back to this client's handler
+    MessageCenter::Subscription handler(center, center.addRequestListener<AllocHandle>(
+        [](int64_t value) {
+            return value;
+        }), true);
+    center.sendRequest<AllocEcho>(echoed, 0);
+    results["request-handler"] = measure(warmup / 10 + 1, requests, [&](uint64_t i) {
+        center.sendRequest<AllocHandle>(echoed, static_cast<int64_t>(i));
+    });
+
+    results["dispatch-typed"] = measureDispatch(center, warmup, messages,
+        [](MessageCenter &c, atomic<uint64_t> &received) {
+            return c.subscribe<AllocEvent>([&received](int64_t, double, const string &) {
+                ++received;
+            });
+        });
+    results["dispatch-json"] = measureDispatch(center, warmup, messages,
+        [](MessageCenter &c, atomic<uint64_t> &received) {
+            return c.subscribe("alloc#event", [&received](const json &) {
+                ++received;
+            });
+        });
+
+    center.stop();
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+    unlink(path.c_str());
+
+    bool ok = true;
+    printf("scenario,messages,allocs_per_msg,budget,result\n");
+    for (auto &&r : results) {
+        const double budget = budgets[r.first];
+        const Result &result = r.second;
+        const bool passed = result.messages > 0 &&
+            result.allocations <= budget * result.messages;
+        ok = ok && passed;
+        printf("%s,%llu,%.2f,%g,%s\n", r.first.c_str(),
+               static_cast<unsigned long long>(result.messages),
+               result.messages > 0 ? static_cast<double>(result.allocations) / result.messages : 0,
+               budget, passed ? "ok" : "FAIL");
+    }
+    return ok ? 0 : 1;
+}
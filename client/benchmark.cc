@@ -0,0 +1,264 @@
+#include "MessageCenter.h"
+#include "MockServer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+BITS_EVENT(BenchEvent, "bench#event", int64_t, std::string);
+BITS_REQUEST(BenchEcho, "bench#echo", std::string, std::string);
+
+// --stamps: send events with latency stamps and report the hops
+static bool latencyStamps = false;
+
+/*
+ * One row of output; unused columns stay 0, latency columns stay empty
+ * without latencies
+ */
+struct Result {
+    const char *scenario;
+    const char *api;
+    size_t payload;
+    size_t publishers;
+    size_t listeners;
+    size_t inflight;
+    uint64_t messages;
+    double seconds;
+    uint64_t bytes;
+    vector<double> latencies;
+};
+
+static void printHeader() {
+    printf("scenario,api,payload,publishers,listeners,inflight,messages,seconds,"
+           "msgs_per_s,bytes_per_s,p50_us,p90_us,p99_us,p999_us,max_us\n");
+}
+
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+static void printResult(Result &r) {
+    sort(r.latencies.begin(), r.latencies.end());
+    printf("%s,%s,%zu,%zu,%zu,%zu,%llu,%.3f,%.0f,%.0f",
+           r.scenario, r.api, r.payload, r.publishers, r.listeners, r.inflight,
+           static_cast<unsigned long long>(r.messages), r.seconds,
+           r.messages / r.seconds, r.bytes / r.seconds);
+    if (r.latencies.empty()) {
+        printf(",,,,,\n");
+    } else {
+        printf(",%.1f,%.1f,%.1f,%.1f,%.1f\n",
+               percentile(r.latencies, 0.50), percentile(r.latencies, 0.90),
+               percentile(r.latencies, 0.99), percentile(r.latencies, 0.999),
+               r.latencies.back());
+    }
+    fflush(stdout);
+}
+
+static int64_t nowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Per hop latencies of the stamped events a MessageCenter received, as
+ * comment lines on stderr so the CSV stays intact
+ */
+static void printHops(MessageCenter &center) {
+    for (auto &&hop : center.timings().hops) {
+        fprintf(stderr, "# hop %s p50_us=%.1f p99_us=%.1f max_us=%.1f\n", hop.first.c_str(),
+                hop.second.p50 / 1e3, hop.second.p99 / 1e3, hop.second.max / 1e3);
+    }
+}
+
+/**
+ * Publishers send events through one MessageCenter, the server fans them
+ * out to a second one with 'listeners' callbacks; timed until every
+ * callback has seen every event. Each event carries its send time, so the
+ * first listener measures the publish to callback latency.
+ */
+static Result benchEvents(const string &path, bool typed, size_t payload,
+                          size_t publishers, size_t listeners, uint64_t messages,
+                          bits::MockServer &server) {
+    MessageCenter subscriber(path);
+    MessageCenter publisher(path);
+    if (!subscriber.start() || !publisher.start()) {
+        fprintf(stderr, "failed to connect to %s\n", path.c_str());
+        exit(-1);
+    }
+    publisher.setLatencyStamps(latencyStamps);
+
+    atomic<uint64_t> received(0);
+    // only the reader thread appends, until subscriber.stop()
+    vector<double> latencies;
+    latencies.reserve(messages);
+    for (size_t i = 0; i < listeners; ++i) {
+        subscriber.addEventListener("bench#event", [&, i](const json &params) {
+            if (i == 0) {
+                const int64_t sent = params[0].get<int64_t>();
+                latencies.push_back((nowNs() - sent) / 1e3);
+            }
+            ++received;
+        });
+    }
+    // the server handles frames in order, so once this returns the
+    // subscription is in place
+    subscriber.sendRequest("bench#sync");
+
+    const string data(payload, 'x');
+    const uint64_t bytesBefore = server.stats().bytesOut;
+    const uint64_t expected = messages * listeners;
+    const Clock::time_point started = Clock::now();
+
+    vector<thread> threads;
+    for (size_t t = 0; t < publishers; ++t) {
+        threads.push_back(thread([&, t] {
+            for (uint64_t n = t; n < messages; n += publishers) {
+                if (typed) {
+                    publisher.sendEvent<BenchEvent>(nowNs(), data);
+                } else {
+                    publisher.sendEvent("bench#event", {}, nowNs(), data);
+                }
+            }
+        }));
+    }
+    for (auto &&t : threads) {
+        t.join();
+    }
+
+    const Clock::time_point deadline = Clock::now() + chrono::seconds(30);
+    while (received < expected && Clock::now() < deadline) {
+        this_thread::sleep_for(chrono::microseconds(200));
+    }
+
+    const double seconds = chrono::duration<double>(Clock::now() - started).count();
+    if (latencyStamps) {
+        printHops(subscriber);
+    }
+    subscriber.stop();
+    Result r = { "events", typed ? "typed" : "json", payload, publishers, listeners, 0,
+                 received / listeners, seconds, server.stats().bytesOut - bytesBefore,
+                 latencies };
+    return r;
+}
+
+/**
+ * 'inflight' threads each send echo requests back to back; every round
+ * trip is timed
+ */
+static Result benchRequests(const string &path, bool typed, size_t payload,
+                            size_t inflight, uint64_t messages,
+                            bits::MockServer &server) {
+    MessageCenter client(path);
+    if (!client.start()) {
+        fprintf(stderr, "failed to connect to %s\n", path.c_str());
+        exit(-1);
+    }
+
+    const string data(payload, 'x');
+    const uint64_t bytesBefore = server.stats().bytesIn + server.stats().bytesOut;
+    vector< vector<double> > latencies(inflight);
+    const Clock::time_point started = Clock::now();
+
+    vector<thread> threads;
+    for (size_t t = 0; t < inflight; ++t) {
+        threads.push_back(thread([&, t] {
+            string echoed;
+            for (uint64_t n = t; n < messages; n += inflight) {
+                Clock::time_point sent = Clock::now();
+                if (typed) {
+                    client.sendRequest<BenchEcho>(echoed, data);
+                } else {
+                    client.sendRequest("bench#echo", {}, data);
+                }
+                latencies[t].push_back(
+                    chrono::duration<double, micro>(Clock::now() - sent).count());
+            }
+        }));
+    }
+    for (auto &&t : threads) {
+        t.join();
+    }
+
+    const double seconds = chrono::duration<double>(Clock::now() - started).count();
+    vector<double> all;
+    for (auto &&l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    Result r = { "requests", typed ? "typed" : "json", payload, 0, 0, inflight,
+                 all.size(), seconds,
+                 server.stats().bytesIn + server.stats().bytesOut - bytesBefore, all };
+    return r;
+}
+
+/**
+ * Usage: ./benchmark [--quick] [--messages N] [--socket PATH] [--stamps]
+ *
+ * Runs MessageCenter against an in-process MockServer and prints one CSV
+ * row per configuration. With --stamps events carry latency stamps and
+ * the per hop latencies are printed to stderr.
+ */
+int main(int argc, char *argv[]) {
+    uint64_t messages = 50000;
+    bool quick = false;
+    string path = "/tmp/bits-bench." + to_string(getpid());
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+            messages = 20000;
+        } else if (arg == "--messages" && i + 1 < argc) {
+            messages = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--socket" && i + 1 < argc) {
+            path = argv[++i];
+        } else if (arg == "--stamps") {
+            latencyStamps = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--quick] [--messages N] [--socket PATH] [--stamps]\n", argv[0]);
+            exit(-1);
+        }
+    }
+
+    bits::MockServer server(path);
+    if (!server.start()) {
+        exit(-1);
+    }
+
+    const vector<size_t> payloads = quick ? vector<size_t>{ 64 } : vector<size_t>{ 16, 256, 4096 };
+    const vector<size_t> publisherCounts = quick ? vector<size_t>{ 1 } : vector<size_t>{ 1, 4 };
+    const vector<size_t> listenerCounts = quick ? vector<size_t>{ 1 } : vector<size_t>{ 1, 8 };
+    const vector<size_t> inflightCounts = quick ? vector<size_t>{ 1, 8 } : vector<size_t>{ 1, 8, 32 };
+    const uint64_t requests = messages / 10;
+
+    printHeader();
+    for (int typed = 0; typed <= 1; ++typed) {
+        for (size_t payload : payloads) {
+            for (size_t publishers : publisherCounts) {
+                for (size_t listeners : listenerCounts) {
+                    Result r = benchEvents(path, typed, payload, publishers, listeners,
+                                           messages, server);
+                    printResult(r);
+                }
+            }
+            for (size_t inflight : inflightCounts) {
+                Result r = benchRequests(path, typed, payload, inflight, requests, server);
+                printResult(r);
+            }
+        }
+    }
+
+    server.stop();
+    return 0;
+}
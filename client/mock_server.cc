@@ -0,0 +1,88 @@
+#include "MockServer.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+static void usage() {
+    cerr << "Usage: ./mock_server SOCKET-PATH [options]" << endl
+         << "  --stream EVENT:RATE[:BYTES]  publish EVENT RATE times a second" << endl
+         << "  --heartbeat MS               send bits-ipc#heartbeat every MS" << endl
+         << "  --ping MS                    send bits-ipc#ping every MS" << endl
+         << "  --system-id ID               answer base#System bitsId with ID" << endl;
+}
+
+/**
+ * Stand-in bits-ipc server; see MockServer.h
+ */
+int main(int argc, char *argv[]) {
+
+    if (argc < 2) {
+        usage();
+        exit(-1);
+    }
+
+    bits::MockServer server(argv[1]);
+
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            exit(-1);
+        }
+        string value = argv[++i];
+
+        if (arg == "--stream") {
+            size_t rate = value.find(':');
+            if (rate == string::npos) {
+                usage();
+                exit(-1);
+            }
+            size_t bytes = value.find(':', rate + 1);
+            server.addStream(value.substr(0, rate),
+                             atof(value.substr(rate + 1, bytes - rate - 1).c_str()),
+                             bytes == string::npos ? 0 : atoi(value.substr(bytes + 1).c_str()));
+        } else if (arg == "--heartbeat") {
+            server.setHeartbeatInterval(atoi(value.c_str()));
+        } else if (arg == "--ping") {
+            server.setPingInterval(atoi(value.c_str()));
+        } else if (arg == "--system-id") {
+            server.setSystemId(value);
+        } else {
+            usage();
+            exit(-1);
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    if (!server.start()) {
+        cerr << "failed to listen on " << argv[1] << endl;
+        exit(-1);
+    }
+    cout << "Mock bits-ipc server listening on " << argv[1] << endl;
+
+    while (!stopRequested) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+
+    server.stop();
+
+    bits::MockServer::Stats stats = server.stats();
+    cout << "connections " << stats.connections
+         << " frames in/out " << stats.framesIn << "/" << stats.framesOut
+         << " bytes in/out " << stats.bytesIn << "/" << stats.bytesOut
+         << " pongs " << stats.pongs << endl;
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include "MessageCenter.h"
+#include "CaptureFile.h"
+#include "Histogram.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static void usage() {
+    fprintf(stderr, "Usage: ./replay CAPTURE [--paced] [--repeat N]\n"
+                    "  --paced     keep the recorded gaps between frames\n"
+                    "  --repeat N  replay the capture N times\n");
+}
+
+/**
+ * Register a listener for every event and a handler for every request
+ * the capture received, so replayed frames take the full dispatch path
+ */
+static void addListeners(bits::CaptureReader &capture, MessageCenter &center) {
+    set<string> events;
+    set<string> requests;
+    bits::CaptureRecord record;
+    while (capture.next(record)) {
+        if (record.direction != 'i') {
+            continue;
+        }
+        try {
+            const json frame = json::parse(string(record.data, record.length));
+            auto data = frame.find("data");
+            if (data == frame.end() || !data->is_object()) {
+                continue;
+            }
+            auto type = data->find("type");
+            auto event = data->find("event");
+            if (type == data->end() || event == data->end() || !event->is_string()) {
+                continue;
+            }
+            if (*type == "event") {
+                events.insert(event->get<string>());
+            } else if (*type == "request") {
+                requests.insert(event->get<string>());
+            }
+        } catch (...) {
+            continue;
+        }
+    }
+    capture.rewind();
+
+    for (auto &&event : events) {
+        center.addEventListener(event, [](const json &) {});
+    }
+    for (auto &&request : requests) {
+        center.addRequestListener(request, [](const json &) {
+            return json();
+        });
+    }
+}
+
+/**
+ * Usage: ./replay CAPTURE [--paced] [--repeat N]
+ *
+ * Feeds the frames a MessageCenter received, as recorded with
+ * startCapture(), back through its framing, parser and dispatch path, as
+ * fast as possible or at the recorded pace, and reports throughput and
+ * the time spent per frame. Frames recorded with the same time arrived in
+ * one read() and are injected together, so they are dispatched in one
+ * cycle as they were live. No bridge is needed; responses are dropped.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage();
+        exit(-1);
+    }
+
+    bool paced = false;
+    unsigned long repeat = 1;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--paced") {
+            paced = true;
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = strtoul(argv[++i], nullptr, 10);
+        } else {
+            usage();
+            exit(-1);
+        }
+    }
+
+    bits::CaptureReader capture;
+    if (!capture.open(argv[1])) {
+        fprintf(stderr, "failed to open capture %s\n", argv[1]);
+        exit(-1);
+    }
+
+    MessageCenter center;
+    addListeners(capture, center);
+
+    bits::Histogram perFrame;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    string read;
+    const Clock::time_point started = Clock::now();
+
+    // inject the frames of one read() and record the time per frame
+    uint64_t readNs = 0;
+    size_t readFrames = 0;
+    auto flush = [&]() {
+        if (readFrames == 0) {
+            return;
+        }
+        const Clock::time_point before = Clock::now();
+        center.inject(read.data(), read.size());
+        const uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - before).count();
+        for (size_t i = 0; i < readFrames; ++i) {
+            perFrame.record(ns / readFrames);
+        }
+        read.clear();
+        readFrames = 0;
+    };
+
+    for (unsigned long pass = 0; pass < repeat; ++pass) {
+        bits::CaptureRecord record;
+        uint64_t firstNs = 0;
+        const Clock::time_point passStarted = Clock::now();
+        while (capture.next(record)) {
+            if (record.direction != 'i') {
+                continue;
+            }
+            if (record.timeNs != readNs) {
+                flush();
+                readNs = record.timeNs;
+            }
+            if (paced && readFrames == 0) {
+                if (firstNs == 0) {
+                    firstNs = record.timeNs;
+                }
+                this_thread::sleep_until(passStarted + chrono::nanoseconds(record.timeNs - firstNs));
+            }
+
+            read.append(record.data, record.length);
+            read.push_back('\f');
+            ++readFrames;
+            ++frames;
+            bytes += record.length;
+        }
+        flush();
+        readNs = 0;
+        capture.rewind();
+    }
+    const uint64_t failed = center.metrics().parseErrors;
+
+    const double seconds = chrono::duration<double>(Clock::now() - started).count();
+    const bits::HistogramSnapshot h = perFrame.snapshot();
+    printf("frames %llu (%llu unparsable), %llu bytes in %.3fs\n",
+           static_cast<unsigned long long>(frames), static_cast<unsigned long long>(failed),
+           static_cast<unsigned long long>(bytes), seconds);
+    printf("%.0f frames/s, %.1f MB/s\n", frames / seconds, bytes / seconds / 1e6);
+    printf("parse + dispatch per frame: mean %.2fus p50 %.2fus p99 %.2fus max %.2fus\n",
+           h.mean / 1e3, h.p50 / 1e3, h.p99 / 1e3, h.max / 1e3);
+    return 0;
+}
@@ -17,9 +17,11 @@ limitations under the License.
 (() => {
   'use strict';
     
-  const EventEmitter = require('events');
   const fs = require('fs');
   const ipc = require('node-ipc');
+  const OutboundQueue = require('./lib/outbound-queue');
+  const EventFilter = require('./lib/event-filter');
+  const WorkerGroup = require('./lib/worker-group');
   const logger = global.helper.LoggerFactory.getLogger();
 
   const Messenger = global.helper.Messenger;
@@ -39,100 +41,638 @@ limitations under the License.
     'removeEventSubscriberListener'
   ];
 
-  let pendingRequests = {};
-  let responseEmitter = new EventEmitter();
+  // How long a BITS request forwarded to an IPC client may stay pending
+  const REQUEST_TIMEOUT_MS = 30000;
+
+  // How many workers a request is tried on before it fails because the
+  // workers handling it disconnected
+  const REQUEST_MAX_ATTEMPTS = 3;
+
+  // A client that has not answered a ping by then shows no ping RTT
+  const PING_TIMEOUT_MS = 5000;
+
+  // Slow-consumer handling for subscriptions that do not ask for a policy,
+  // see lib/outbound-queue.js
+  const DEFAULT_DELIVERY = {
+    policy: 'dropOldest',
+    maxQueue: 10000
+  };
+
+  // BITS requests waiting on an IPC client response, keyed by requestId
+  const pendingRequests = new Map();
+
+  // Pings sent straight to IPC clients from the heartbeat loop, keyed by
+  // requestId; see pingClients
+  const pendingPings = new Map();
+  let lastPingId = 0;
+
+  // One BITS event listener per (event, scope), shared by every IPC
+  // socket subscribed to it; see addEventSubscriber
+  const eventSubscriptions = new Map();
+
+  // One BITS request listener per (request, scope), load balanced across
+  // every IPC socket serving it; see addRequestWorker
+  const requestGroups = new Map();
+
+  // Everything registered on behalf of each connected IPC socket, so it
+  // can be undone by a remove message or all at once on disconnect
+  const ipcSockets = new Map();
+
+  let lastSocketId = 0;
+
+  // Latency stamps of the IPC message currently being sent into BITS,
+  // for the BITS listeners it reaches synchronously; see handOffStamps
+  let handedOffStamps = null;
+
+  function socketState(socket) {
+    let state = ipcSockets.get(socket);
+    if (!state) {
+      const id = ++lastSocketId;
+      state = {
+        id: id,
+        // corked, batched writes to this client
+        queue: new OutboundQueue(socket, {
+          onSlow: (buffered) => {
+            logger.warn(`IPC client ${id} is not keeping up, ${buffered} bytes buffered`);
+          },
+          onRecover: (buffered, stats) => {
+            logger.info(`IPC client ${id} caught up, ${buffered} bytes buffered, ` +
+              `${stats.dropped} dropped, ${stats.conflated} conflated so far`);
+          },
+          onDisconnect: (key) => {
+            logger.warn(`Disconnecting IPC client ${id}, too slow for ${key}`);
+          }
+        }),
+        // keys into eventSubscriptions
+        events: new Set(),
+        // keys into requestGroups
+        requests: new Set(),
+        // events withheld by this client's subscription filters
+        filtered: 0,
+        // bits-ipc frames received from this client
+        framesIn: 0,
+        // per second rates over the last sampling interval, see sampleStats
+        rates: {framesIn: 0, framesOut: 0, bytesIn: 0, bytesOut: 0},
+        lastSample: null,
+        // round trip of the last answered bits-ipc#ping, in milliseconds
+        pingRtt: null
+      };
+      ipcSockets.set(socket, state);
+    }
+    return state;
+  }
+
+  function listenerKey(kind, msg) {
+    return kind + ':' + msg.event + ':' + JSON.stringify(msg.params[0]);
+  }
+
+  /**
+   * The scopes an add*Listener message registers on, null for the
+   * default scope
+   */
+  function listenerScopes(msg) {
+    const scope = msg.params && msg.params[0];
+    return scope && scope.scopes !== undefined ? scope.scopes : null;
+  }
+
+  /**
+   * Drop every BITS listener and pending request owned by a socket that
+   * disconnected, instead of waiting for the next event to notice
+   */
+  function releaseSocket(messageCenter, socket) {
+    const state = ipcSockets.get(socket);
+    if (!state) {
+      return;
+    }
+    ipcSockets.delete(socket);
+
+    for (const key of state.events) {
+      removeEventSubscriber(messageCenter, socket, key, null);
+    }
+    for (const key of state.requests) {
+      removeRequestWorker(messageCenter, socket, key, true);
+    }
+
+    // hand requests the socket was working on to the rest of its group
+    for (const [requestId, pending] of pendingRequests) {
+      if (pending.socket === socket &&
+          (pending.attempts >= REQUEST_MAX_ATTEMPTS || !forwardRequest(requestId, pending))) {
+        completeRequest(requestId, new Error('IPC client disconnected'));
+      }
+    }
+    for (const [requestId, ping] of pendingPings) {
+      if (ping.socket === socket) {
+        pendingPings.delete(requestId);
+      }
+    }
+  }
+
+  /**
+   * Totals for one client, the basis for rates and the stats table
+   */
+  function clientTotals(socket, state) {
+    return {
+      framesIn: state.framesIn,
+      framesOut: state.queue.stats.frames,
+      bytesIn: socket.bytesRead || 0,
+      bytesOut: state.queue.stats.bytes
+    };
+  }
+
+  /**
+   * Update every client's per second rates; called once a second
+   */
+  function sampleStats() {
+    const now = process.hrtime.bigint();
+    for (const [socket, state] of ipcSockets) {
+      const totals = clientTotals(socket, state);
+      const last = state.lastSample;
+      if (last) {
+        const seconds = Number(now - last.time) / 1e9;
+        for (const key of Object.keys(state.rates)) {
+          state.rates[key] = seconds > 0 ? (totals[key] - last.totals[key]) / seconds : 0;
+        }
+      }
+      state.lastSample = {time: now, totals: totals};
+    }
+  }
+
+  /**
+   * Per client statistics, answered to bits-ipc#Client stats
+   */
+  function clientStats() {
+    const inFlight = new Map();
+    for (const pending of pendingRequests.values()) {
+      if (pending.socket) {
+        inFlight.set(pending.socket, (inFlight.get(pending.socket) || 0) + 1);
+      }
+    }
+
+    return Array.from(ipcSockets, ([socket, state]) => {
+      const totals = clientTotals(socket, state);
+      const stats = state.queue.stats;
+      return {
+        id: state.id,
+        framesIn: totals.framesIn,
+        framesOut: totals.framesOut,
+        bytesIn: totals.bytesIn,
+        bytesOut: totals.bytesOut,
+        framesInPerSecond: Math.round(state.rates.framesIn),
+        framesOutPerSecond: Math.round(state.rates.framesOut),
+        bytesInPerSecond: Math.round(state.rates.bytesIn),
+        bytesOutPerSecond: Math.round(state.rates.bytesOut),
+        inFlightRequests: inFlight.get(socket) || 0,
+        pingRtt: state.pingRtt,
+        bufferedBytes: state.queue.bufferedBytes(),
+        queuedFrames: state.queue.queuedFrames(),
+        slow: state.queue.isSlow(),
+        dropped: stats.dropped,
+        conflated: stats.conflated,
+        filtered: state.filtered,
+        subscriptions: state.events.size,
+        requestGroups: state.requests.size
+      };
+    });
+  }
+
+  /**
+   * Send bits-ipc#ping to every client serving it and time the answer
+   * per client. A client still owing the previous ping is skipped until
+   * that ping times out.
+   */
+  function pingClients() {
+    const now = process.hrtime.bigint();
+    const waiting = new Set();
+    for (const [requestId, ping] of pendingPings) {
+      if (Number(now - ping.sent) / 1e6 > PING_TIMEOUT_MS) {
+        pendingPings.delete(requestId);
+        const state = ipcSockets.get(ping.socket);
+        if (state) {
+          state.pingRtt = null;
+        }
+      } else {
+        waiting.add(ping.socket);
+      }
+    }
+
+    for (const [socket, state] of ipcSockets) {
+      const serves = Array.from(state.requests).some((key) => {
+        const requestGroup = requestGroups.get(key);
+        return requestGroup && requestGroup.event === 'bits-ipc#ping';
+      });
+      if (!serves || waiting.has(socket) || socket.destroyed) {
+        continue;
+      }
+
+      const requestId = 'bits-ipc-ping-' + (++lastPingId);
+      pendingPings.set(requestId, {socket: socket, sent: now});
+      sendFrame(socket, encodeFrame({
+        type: 'request',
+        requestId: requestId,
+        event: 'bits-ipc#ping',
+        params: [Date.now()]
+      }));
+    }
+  }
+
+  function completePing(responseId) {
+    const ping = pendingPings.get(responseId);
+    pendingPings.delete(responseId);
+    const state = ipcSockets.get(ping.socket);
+    if (state) {
+      state.pingRtt = Number(process.hrtime.bigint() - ping.sent) / 1e6;
+    }
+  }
+
+  /**
+   * Append a [hop, nanoseconds] latency stamp. process.hrtime() reads
+   * CLOCK_MONOTONIC like the C++ client; the nanoseconds are sent as a
+   * string since they do not fit a double.
+   */
+  function addStamp(stamps, hop) {
+    stamps.push([hop, process.hrtime.bigint().toString()]);
+    return stamps;
+  }
+
+  /**
+   * Make the stamps of msg, if any, available to takeStamps() for the
+   * duration of send()
+   */
+  function handOffStamps(msg, send) {
+    handedOffStamps = Array.isArray(msg.stamps) ? msg.stamps : null;
+    try {
+      return send();
+    } finally {
+      handedOffStamps = null;
+    }
+  }
+
+  /**
+   * A copy of the handed off stamps with the bits-dispatch hop, or null.
+   * Only BITS listeners called from within the send see them; messages
+   * BITS delivers later lose their stamps at the bridge.
+   */
+  function takeStamps() {
+    return handedOffStamps ? addStamp(handedOffStamps.slice(), 'bits-dispatch') : null;
+  }
+
+  /**
+   * Encode a bits-ipc frame exactly as ipc.server.emit() would, so one
+   * buffer can be written to any number of sockets
+   */
+  function encodeFrame(data) {
+    return Buffer.from(JSON.stringify({type: 'bits-ipc', data: data}) + ipc.config.delimiter);
+  }
+
+  /**
+   * Queue an encoded frame on the socket's outbound queue
+   */
+  function sendFrame(socket, frame, delivery) {
+    if (socket.destroyed) {
+      return false;
+    }
+    return socketState(socket).queue.write(frame, delivery);
+  }
+
+  /**
+   * Subscription options arrive in params[1] of addEventListener:
+   * {policy: 'dropOldest' | 'conflate' | 'disconnect' | 'latest', maxQueue: N,
+   *  filter: see lib/event-filter.js, tag: N}
+   * A client tags each subscription whose filter samples; frames to it
+   * list the tags of the subscriptions that accepted them.
+   */
+  function subscriptionOptions(msg) {
+    const options = (msg.params && msg.params[1]) || {};
+    let filter = null;
+    try {
+      filter = EventFilter.compile(options.filter);
+    } catch (err) {
+      logger.warn(`Ignoring invalid filter for ${msg.event}:`, err.message);
+    }
+    return {
+      filter: filter,
+      tag: filter && options.tag > 0 ? options.tag : undefined,
+      policy: OutboundQueue.POLICIES.includes(options.policy) ? options.policy : DEFAULT_DELIVERY.policy,
+      maxQueue: options.maxQueue > 0 ? options.maxQueue : DEFAULT_DELIVERY.maxQueue,
+      raw: JSON.stringify(msg.params ? msg.params[1] || null : null)
+    };
+  }
+
+  /**
+   * When one socket holds several subscriptions to the same (event,
+   * scope) the least lossy policy wins: disconnect, dropOldest, conflate,
+   * latest
+   */
+  function effectiveDelivery(key, entries) {
+    const rank = {disconnect: 0, dropOldest: 1, conflate: 2, latest: 3};
+    let delivery = null;
+    for (const options of entries) {
+      if (!delivery || rank[options.policy] < rank[delivery.policy] ||
+          (options.policy === delivery.policy && options.maxQueue > delivery.maxQueue)) {
+        delivery = {key: key, policy: options.policy, maxQueue: options.maxQueue};
+      }
+    }
+    return delivery;
+  }
+
+  /**
+   * Subscribe socket to msg.event. The first subscriber for an
+   * (event, scope) registers the BITS listener; every event it receives
+   * is serialized once and the same buffer is written to all subscribed
+   * sockets whose filters accept it.
+   */
+  function addEventSubscriber(messageCenter, socket, msg) {
+    const key = listenerKey('event', msg);
+    let subscription = eventSubscriptions.get(key);
+    if (!subscription) {
+      subscription = {
+        key: key,
+        event: msg.event,
+        // echoed in every frame so clients can tell scopes apart
+        scopes: listenerScopes(msg),
+        sockets: new Map()
+      };
+      subscription.listener = (...data) => {
+        const stamps = takeStamps();
+        // only serialize once some subscriber's filter lets the event through
+        let message = null;
+        let frame = null;
+        for (const [target, subscriber] of Array.from(subscription.sockets)) {
+          if (target.destroyed) {
+            // drop sockets that went away
+            removeEventSubscriber(messageCenter, target, subscription.key, null);
+            continue;
+          }
+          // every filter sees every event, or a sample clause behind an
+          // entry that already accepted would skip its count
+          let accepted = false;
+          let tags = null;
+          for (const options of subscriber.entries) {
+            if (!options.filter || options.filter(data)) {
+              accepted = true;
+              if (options.tag !== undefined) {
+                (tags = tags || []).push(options.tag);
+              }
+            }
+          }
+          if (!accepted) {
+            socketState(target).filtered++;
+            continue;
+          }
+          if (!message) {
+            message = {
+              type: 'event',
+              event: subscription.event,
+              scopes: subscription.scopes,
+              params: data,
+              stamps: stamps ? addStamp(stamps, 'bridge-send') : undefined
+            };
+          }
+          if (subscriber.tagged) {
+            // which sampled subscriptions the frame is for differs per
+            // socket, so it cannot share the frame
+            sendFrame(target, encodeFrame(Object.assign({tags: tags || []}, message)),
+                      subscriber.delivery);
+            continue;
+          }
+          if (!frame) {
+            frame = encodeFrame(message);
+          }
+          sendFrame(target, frame, subscriber.delivery);
+        }
+      };
+      eventSubscriptions.set(key, subscription);
+      messageCenter.addEventListener(msg.event, msg.params[0], subscription.listener);
+    }
+
+    // one socket may hold several subscriptions, e.g. with different options
+    let subscriber = subscription.sockets.get(socket);
+    if (!subscriber) {
+      subscriber = {entries: []};
+      subscription.sockets.set(socket, subscriber);
+    }
+    subscriber.entries.push(subscriptionOptions(msg));
+    subscriber.delivery = effectiveDelivery(key, subscriber.entries);
+    subscriber.tagged = subscriber.entries.some((options) => options.tag !== undefined);
+    socketState(socket).events.add(key);
+  }
+
+  /**
+   * Undo the addEventSubscriber that msg matches (or all of them for
+   * socket when msg is null); the BITS listener is removed with the last
+   * subscriber.
+   */
+  function removeEventSubscriber(messageCenter, socket, key, msg) {
+    const subscription = eventSubscriptions.get(key);
+    if (!subscription || !subscription.sockets.has(socket)) {
+      return;
+    }
+
+    const subscriber = subscription.sockets.get(socket);
+    if (msg) {
+      const raw = subscriptionOptions(msg).raw;
+      const index = subscriber.entries.findIndex((options) => options.raw === raw);
+      subscriber.entries.splice(index >= 0 ? index : subscriber.entries.length - 1, 1);
+      if (subscriber.entries.length > 0) {
+        subscriber.delivery = effectiveDelivery(key, subscriber.entries);
+        subscriber.tagged = subscriber.entries.some((options) => options.tag !== undefined);
+        return;
+      }
+    }
+
+    subscription.sockets.delete(socket);
+    const state = ipcSockets.get(socket);
+    if (state) {
+      state.events.delete(key);
+    }
+    if (subscription.sockets.size === 0) {
+      eventSubscriptions.delete(key);
+      messageCenter.removeEventListener(subscription.event, subscription.listener);
+    }
+  }
+
+  /**
+   * Join socket to the worker group serving msg.event on msg.params[0].
+   * The first worker registers the BITS request listener; the group's
+   * strategy comes from params[1] of that first registration:
+   * {balance: 'leastLoaded' | 'roundRobin' | 'shard', shardKey: path,
+   *  workerId: name on the shard ring, defaults to the connection}
+   */
+  function addRequestWorker(messageCenter, socket, msg) {
+    const key = listenerKey('request', msg);
+    const options = (msg.params && msg.params[1]) || {};
+    let requestGroup = requestGroups.get(key);
+    if (!requestGroup) {
+      requestGroup = {
+        key: key,
+        event: msg.event,
+        scopes: listenerScopes(msg),
+        workers: new WorkerGroup(options.balance, options.shardKey)
+      };
+      requestGroup.listener = (metadata, ...data) => {
+        return new Promise((resolve, reject) => {
+          const pending = {
+            resolve: resolve,
+            reject: reject,
+            group: requestGroup,
+            params: data,
+            socket: null,
+            attempts: 0,
+            stamps: takeStamps()
+          };
+          pending.timer = setTimeout(() => {
+            completeRequest(metadata.requestId, new Error(`IPC request ${requestGroup.event} timed out`));
+          }, REQUEST_TIMEOUT_MS);
+          pendingRequests.set(metadata.requestId, pending);
+
+          if (!forwardRequest(metadata.requestId, pending)) {
+            completeRequest(metadata.requestId, new Error(`No IPC client serving ${requestGroup.event}`));
+          }
+        });
+      };
+      requestGroups.set(key, requestGroup);
+      messageCenter.addRequestListener(msg.event, msg.params[0], requestGroup.listener);
+    }
+
+    const state = socketState(socket);
+    requestGroup.workers.join(socket, options.workerId || ('ipc-' + state.id));
+    state.requests.add(key);
+  }
+
+  /**
+   * Undo one addRequestWorker (or all of them when all is set); the BITS
+   * listener is removed with the last worker
+   */
+  function removeRequestWorker(messageCenter, socket, key, all) {
+    const requestGroup = requestGroups.get(key);
+    if (!requestGroup || !requestGroup.workers.leave(socket, all)) {
+      return;
+    }
+
+    const state = ipcSockets.get(socket);
+    if (state) {
+      state.requests.delete(key);
+    }
+    if (requestGroup.workers.size === 0) {
+      requestGroups.delete(key);
+      messageCenter.removeRequestListener(requestGroup.event, requestGroup.listener);
+    }
+  }
+
+  /**
+   * Send a pending request to the next worker of its group. Returns
+   * false if no worker is left.
+   */
+  function forwardRequest(requestId, pending) {
+    const workers = pending.group.workers;
+    const socket = workers.pick(pending.params);
+    if (!socket) {
+      return false;
+    }
+
+    pending.socket = socket;
+    pending.attempts++;
+    workers.begin(socket);
+    sendFrame(socket, encodeFrame({
+      type: 'request',
+      requestId: requestId,
+      event: pending.group.event,
+      scopes: pending.group.scopes,
+      params: pending.params,
+      stamps: pending.stamps ? addStamp(pending.stamps.slice(), 'bridge-send') : undefined
+    }));
+    return true;
+  }
+
+  /**
+   * Settle the pending BITS request answered by an IPC response
+   */
+  function completeRequest(responseId, err, result) {
+    const pending = pendingRequests.get(responseId);
+    if (!pending) {
+      logger.debug('Ignoring response for unknown request', responseId);
+      return;
+    }
+
+    pendingRequests.delete(responseId);
+    clearTimeout(pending.timer);
+    if (pending.socket) {
+      pending.group.workers.end(pending.socket);
+    }
+    if (err) {
+      pending.reject(err);
+    } else {
+      pending.resolve(result);
+    }
+  }
+
+  /**
+   * An IPC client no longer serves a request it was sent (its handler was
+   * removed while the request was in flight); hand it to the rest of the
+   * group as releaseSocket does
+   */
+  function declineRequest(responseId, err) {
+    const pending = pendingRequests.get(responseId);
+    if (!pending) {
+      return;
+    }
+
+    pending.group.workers.end(pending.socket);
+    if (pending.attempts >= REQUEST_MAX_ATTEMPTS || !forwardRequest(responseId, pending)) {
+      pending.socket = null;
+      completeRequest(responseId, new Error(err));
+    }
+  }
 
   function handleIpcMessage(messageCenter, socket, msg) {
     try {
       if (msg.type === "event") {
         // Events are easy, just forward them to the BITS message center
-        messageCenter.sendEvent(msg.event, ...msg.params);
+        handOffStamps(msg, () => messageCenter.sendEvent(msg.event, ...msg.params));
       } else if (msg.type === "request") {
         // For requests we pass the request to the BITS message center
         // tied to a callback with this socket.  When the BITS
         // response comes back we forward it to IPC
-        messageCenter.sendRequest(msg.event, ...msg.params)
+        handOffStamps(msg, () => messageCenter.sendRequest(msg.event, ...msg.params))
         .then((...data) => {
-          ipc.server.emit(
-            socket,
-            'bits-ipc',
-            {
-              type: 'response',
-              event: msg.event,
-              responseId: msg.requestId,
-              err: null,
-              result: data
-            }
-          );
+          sendFrame(socket, encodeFrame({
+            type: 'response',
+            event: msg.event,
+            responseId: msg.requestId,
+            err: null,
+            result: data
+          }));
         })
         .catch((err) => {
           logger.error('error on request', err);
+          // answer anyway so the client's sendRequest does not wait
+          sendFrame(socket, encodeFrame({
+            type: 'response',
+            event: msg.event,
+            responseId: msg.requestId,
+            err: String(err && err.message || err),
+            result: null
+          }));
         });
       } else if (msg.type === "response") {
         // For requests we pass the request to the BITS message center
         // tied to a callback with this socket.  When the BITS
         // response comes back we forward it to IPC
-        responseEmitter.emit(msg.event, msg.responseId, msg.err, msg.params);
-      } else if (msg.type === "addEventListener") {
-        let scope = msg.params[0];
-        let listener = (...data) => { 
-          if (!socket.destroyed) {
-            // if the socket is still active, sent the event
-            ipc.server.emit(
-              socket,
-              'bits-ipc',
-              {
-                type: 'event',
-                event: msg.event,
-                params: data
-              }
-            );
-          } else {
-            // otherwise remove this listener
-            messageCenter.removeEventListener(msg.event, listener);
-          }
+        if (pendingPings.has(msg.responseId)) {
+          completePing(msg.responseId);
+        } else if (msg.unhandled) {
+          declineRequest(msg.responseId, msg.err);
+        } else {
+          completeRequest(msg.responseId, msg.err, msg.params);
         }
-        messageCenter.addEventListener(msg.event, scope, listener);
+      } else if (msg.type === "addEventListener") {
+        addEventSubscriber(messageCenter, socket, msg);
+      } else if (msg.type === "removeEventListener") {
+        removeEventSubscriber(messageCenter, socket, listenerKey('event', msg), msg);
       } else if (msg.type === "addRequestListener") {
-        let scope = msg.params[0];
-        let listener = (metadata, ...data) => { 
-          if (!socket.destroyed) {
-            // if the socket is still active, sent the event
-            ipc.server.emit(
-              socket,
-              'bits-ipc',
-              {
-                type: 'request',
-                requestId: metadata.requestId,
-                event: msg.event,
-                params: data
-              }
-            );
-
-
-            let responsePromise = new Promise((resolve, reject) => {
-              const handleIpcResponse = (responseId, err, result) => {
-                if (responseId === metadata.requestId) {
-                  responseEmitter.removeListener(msg.event, handleIpcResponse);
-                  if (err) {
-                    reject(err);
-                  } else {
-                    resolve(result);
-                  }
-                }
-              };
-              responseEmitter.on(msg.event, handleIpcResponse);
-
-            });
-
-            return responsePromise;
-          } else {
-            // otherwise remove this listener
-            messageCenter.removeRequestListener(msg.event, listener);
-            return Promise.resolve();
-          }
-        }
-        messageCenter.addRequestListener(msg.event, scope, listener);
+        addRequestWorker(messageCenter, socket, msg);
+      } else if (msg.type === "removeRequestListener") {
+        removeRequestWorker(messageCenter, socket, listenerKey('request', msg), false);
       }
     } catch (err) {
       logger.warn('Failed to send IPC message', err);
@@ -160,6 +700,10 @@ limitations under the License.
         }
         
         logger.debug('Received IPC message', msg);
+        socketState(socket).framesIn++;
+        if (Array.isArray(msg.stamps)) {
+          addStamp(msg.stamps, 'bridge-recv');
+        }
  
         if (msg && validMessageTypes.includes(msg.type)) {
           handleIpcMessage(messageCenter, socket, msg);
@@ -168,6 +712,11 @@ limitations under the License.
         }
       });
 
+      // Tear down everything a client registered as soon as it goes away
+      ipc.server.on('socket.disconnected', (socket) => {
+        releaseSocket(messageCenter, socket);
+      });
+
       // start the server
       ipc.server.start();
     })
@@ -183,6 +732,9 @@ limitations under the License.
       this._messenger.addEventListener('bits-ipc#Client connected', {scopes: null}, (name) => {
         logger.info("IPC client connected");
       });
+      this._messenger.addRequestListener('bits-ipc#Client stats', {scopes: null}, () => {
+        return Promise.resolve(clientStats());
+      });
     }
 
     load(messageCenter) {
@@ -200,6 +752,9 @@ limitations under the License.
           // TODO update a watchdog?
         })
         .catch((err) => { console.log(err) });
+        // and each client directly, so every client gets its own RTT
+        pingClients();
+        sampleStats();
       }, 1000);
     }
 
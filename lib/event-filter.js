@@ -0,0 +1,135 @@
+/**
+Copyright 2017 LGS Innovations
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+**/
+
+(() => {
+  'use strict';
+
+  /**
+   * Event filters are declarative predicates a client attaches to an
+   * addEventListener subscription (params[1].filter). They are evaluated
+   * against the event params before the bridge serializes the event.
+   *
+   *   {all: [clause, ...]}
+   *
+   * where each clause is one of
+   *
+   *   {path: '0.sensorId', eq: 7}
+   *   {path: '0.sensorId', in: [7, 8]}
+   *   {path: '1', gte: 10, lt: 20}        (any of gt, gte, lt, lte)
+   *   {sample: 10}                        (every 10th event that passes
+   *                                        the clauses before it)
+   *
+   * Paths are dot separated; numeric segments index arrays, the root is
+   * the params array. Keep in sync with client/EventFilter.h.
+   */
+
+  /**
+   * Look up a dot separated path (already split) in the params array
+   */
+  function resolve(params, segments) {
+    let value = params;
+    for (const segment of segments) {
+      if (value === null || typeof value !== 'object') {
+        return undefined;
+      }
+      value = Array.isArray(value) ? value[Number(segment)] : value[segment];
+    }
+    return value;
+  }
+
+  function equal(a, b) {
+    if (a === b) {
+      return true;
+    }
+    if (a === null || b === null || typeof a !== 'object' || typeof b !== 'object') {
+      return false;
+    }
+    return JSON.stringify(a) === JSON.stringify(b);
+  }
+
+  function compileClause(clause) {
+    if (clause === null || typeof clause !== 'object') {
+      throw new TypeError('filter clause must be an object');
+    }
+
+    if (clause.sample !== undefined) {
+      const every = Math.floor(Number(clause.sample));
+      if (!(every >= 1)) {
+        throw new TypeError('sample must be a positive integer');
+      }
+      let seen = 0;
+      return () => (seen++ % every) === 0;
+    }
+
+    if (typeof clause.path !== 'string' && typeof clause.path !== 'number') {
+      throw new TypeError('filter clause needs a path');
+    }
+    const segments = String(clause.path).split('.');
+    const tests = [];
+
+    if ('eq' in clause) {
+      tests.push((value) => equal(value, clause.eq));
+    }
+    if ('in' in clause) {
+      if (!Array.isArray(clause.in)) {
+        throw new TypeError('"in" must be an array');
+      }
+      tests.push((value) => clause.in.some((candidate) => equal(value, candidate)));
+    }
+    if ('gt' in clause) {
+      tests.push((value) => typeof value === 'number' && value > clause.gt);
+    }
+    if ('gte' in clause) {
+      tests.push((value) => typeof value === 'number' && value >= clause.gte);
+    }
+    if ('lt' in clause) {
+      tests.push((value) => typeof value === 'number' && value < clause.lt);
+    }
+    if ('lte' in clause) {
+      tests.push((value) => typeof value === 'number' && value <= clause.lte);
+    }
+    if (tests.length === 0) {
+      throw new TypeError('filter clause has no condition');
+    }
+
+    return (params) => {
+      const value = resolve(params, segments);
+      return tests.every((test) => test(value));
+    };
+  }
+
+  /**
+   * Compile a filter spec into a predicate over the event params.
+   * Returns null for an empty spec; throws TypeError for a malformed one.
+   */
+  function compile(spec) {
+    if (spec === undefined || spec === null) {
+      return null;
+    }
+    const clauses = Array.isArray(spec) ? spec : (Array.isArray(spec.all) ? spec.all : [spec]);
+    if (clauses.length === 0) {
+      return null;
+    }
+
+    const predicates = clauses.map(compileClause);
+    return (params) => predicates.every((predicate) => predicate(params));
+  }
+
+  module.exports = {
+    compile: compile,
+    resolve: resolve
+  };
+})();
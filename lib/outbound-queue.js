@@ -0,0 +1,311 @@
+/**
+Copyright 2017 LGS Innovations
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+**/
+
+(() => {
+  'use strict';
+
+  // Flush a corked socket early once this many bytes are pending
+  const DEFAULT_FLUSH_BYTES = 64 * 1024;
+
+  // Bytes buffered in node for one socket before it counts as slow
+  const DEFAULT_HIGH_WATER_MARK = 1024 * 1024;
+
+  // What happens to an event frame while its socket is slow:
+  //   'dropOldest' - hold up to maxQueue frames per subscription, dropping
+  //                  the oldest beyond that
+  //   'conflate'   - hold only the latest frame per subscription
+  //   'disconnect' - close the socket
+  //   'latest'     - like 'conflate', and also conflated within each
+  //                  flush so the client sees at most one frame per
+  //                  subscription per event loop turn
+  // Frames written without a policy (requests, responses) are always held.
+  const POLICIES = ['dropOldest', 'conflate', 'disconnect', 'latest'];
+
+  /**
+   * Outbound path for one IPC socket. Frames written during an event loop
+   * turn are corked together and flushed once per turn (or earlier when
+   * flushBytes accumulate), so a burst of events becomes one write.
+   *
+   * Bytes buffered in node are tracked against a high water mark. Once a
+   * client crosses it, frames stop going to the socket and wait in a
+   * bridge-side backlog where each subscription's policy bounds them; the
+   * backlog is written out again after the socket drains.
+   */
+  class OutboundQueue {
+    constructor(socket, options) {
+      options = options || {};
+      this._socket = socket;
+      this._flushBytes = options.flushBytes || DEFAULT_FLUSH_BYTES;
+      this._highWaterMark = options.highWaterMark || DEFAULT_HIGH_WATER_MARK;
+      this._onSlow = options.onSlow || (() => {});
+      this._onRecover = options.onRecover || (() => {});
+      this._onDisconnect = options.onDisconnect || (() => {});
+
+      this._corked = false;
+      this._scheduled = false;
+      this._immediate = null;
+      this._pendingBytes = 0;
+      this._slow = false;
+
+      // frames held while slow, in send order; dropped entries are
+      // tombstoned (frame = null) and skipped when draining
+      this._backlog = [];
+      this._backlogHead = 0;
+      // subscription key -> its live backlog entries, oldest first
+      this._backlogByKey = new Map();
+      // frames of this turn from the first pending 'latest' frame on, in
+      // send order, written out by the next flush; later frames queue
+      // behind it so it is not reordered
+      this._pending = [];
+      // subscription key -> its 'latest' entry in _pending, replaced in
+      // place by newer frames
+      this._latest = new Map();
+
+      this.stats = {
+        frames: 0,
+        bytes: 0,
+        flushes: 0,
+        maxBuffered: 0,
+        queued: 0,
+        maxQueued: 0,
+        dropped: 0,
+        conflated: 0,
+        disconnected: 0
+      };
+
+      this._flush = () => {
+        this._scheduled = false;
+        this.flush();
+      };
+
+      socket.on('drain', () => this._checkHighWater());
+    }
+
+    /**
+     * Queue an encoded frame. 'delivery' is {key, policy, maxQueue} for
+     * event frames. Returns false if the frame will not be sent.
+     */
+    write(frame, delivery) {
+      if (this._socket.destroyed) {
+        return false;
+      }
+
+      // frames behind a pending 'latest' frame wait for it, even if the
+      // socket turned slow meanwhile; flush() holds them in order
+      if (this._pending.length === 0 && (this._slow || this.stats.queued > 0)) {
+        return this._hold(frame, delivery);
+      }
+
+      if (delivery && delivery.policy === 'latest') {
+        const entry = this._latest.get(delivery.key);
+        if (entry) {
+          // keep the pending slot, replace its value with the latest
+          entry.frame = frame;
+          this.stats.conflated++;
+          return true;
+        }
+        const latest = {frame: frame, delivery: delivery};
+        this._latest.set(delivery.key, latest);
+        this._pending.push(latest);
+        this._schedule();
+        return true;
+      }
+
+      if (this._pending.length > 0) {
+        this._pending.push({frame: frame, delivery: delivery});
+        return true;
+      }
+
+      this._write(frame);
+      return true;
+    }
+
+    /**
+     * Hand everything corked so far to the socket
+     */
+    flush() {
+      if (this._pending.length > 0) {
+        const frames = this._pending;
+        this._pending = [];
+        this._latest.clear();
+        for (const pending of frames) {
+          if (this._slow || this.stats.queued > 0) {
+            this._hold(pending.frame, pending.delivery);
+          } else {
+            this._write(pending.frame);
+          }
+        }
+      }
+
+      if (this._corked) {
+        this._corked = false;
+        this._pendingBytes = 0;
+        this.stats.flushes++;
+        this._socket.uncork();
+      }
+
+      // nothing is left corked, so a flush scheduled meanwhile (by the
+      // writes above, or before an early flush) would have nothing to do
+      if (this._scheduled) {
+        clearImmediate(this._immediate);
+        this._scheduled = false;
+      }
+    }
+
+    /**
+     * Bytes written but not yet accepted by the kernel
+     */
+    bufferedBytes() {
+      return this._socket.writableLength;
+    }
+
+    /**
+     * Frames held in the bridge-side backlog
+     */
+    queuedFrames() {
+      return this.stats.queued;
+    }
+
+    isSlow() {
+      return this._slow;
+    }
+
+    _schedule() {
+      if (!this._scheduled) {
+        this._scheduled = true;
+        this._immediate = setImmediate(this._flush);
+      }
+    }
+
+    _write(frame) {
+      const socket = this._socket;
+      if (!this._corked) {
+        socket.cork();
+        this._corked = true;
+      }
+      this._schedule();
+
+      socket.write(frame);
+      this._pendingBytes += frame.length;
+      this.stats.frames++;
+      this.stats.bytes += frame.length;
+
+      if (this._pendingBytes >= this._flushBytes) {
+        this.flush();
+      }
+      this._checkHighWater();
+    }
+
+    _hold(frame, delivery) {
+      const policy = delivery ? delivery.policy : undefined;
+
+      if (policy === 'disconnect') {
+        this.stats.disconnected++;
+        this._onDisconnect(delivery.key);
+        this._socket.destroy();
+        return false;
+      }
+
+      let entries;
+      if (policy) {
+        entries = this._backlogByKey.get(delivery.key);
+        if (!entries) {
+          entries = [];
+          this._backlogByKey.set(delivery.key, entries);
+        }
+
+        if ((policy === 'conflate' || policy === 'latest') && entries.length > 0) {
+          // keep the pending slot, replace its value with the latest
+          entries[entries.length - 1].frame = frame;
+          this.stats.conflated++;
+          return true;
+        }
+      }
+
+      const entry = {frame: frame, key: policy ? delivery.key : undefined};
+      this._backlog.push(entry);
+      this.stats.queued++;
+      if (this.stats.queued > this.stats.maxQueued) {
+        this.stats.maxQueued = this.stats.queued;
+      }
+
+      if (entries) {
+        entries.push(entry);
+        if (policy === 'dropOldest' && entries.length > delivery.maxQueue) {
+          entries.shift().frame = null;
+          this.stats.queued--;
+          this.stats.dropped++;
+        }
+      }
+      return true;
+    }
+
+    /**
+     * Write held frames until the backlog is empty or the socket is slow
+     */
+    _drainBacklog() {
+      const backlog = this._backlog;
+      while (this._backlogHead < backlog.length && !this._slow) {
+        const entry = backlog[this._backlogHead++];
+        if (entry.frame === null) {
+          continue;
+        }
+
+        if (entry.key !== undefined) {
+          const entries = this._backlogByKey.get(entry.key);
+          entries.shift();
+          if (entries.length === 0) {
+            this._backlogByKey.delete(entry.key);
+          }
+        }
+        this.stats.queued--;
+        this._write(entry.frame);
+      }
+
+      if (this._backlogHead === backlog.length) {
+        this._backlog = [];
+        this._backlogHead = 0;
+      } else if (this._backlogHead > 1024 && this._backlogHead * 2 > backlog.length) {
+        this._backlog = backlog.slice(this._backlogHead);
+        this._backlogHead = 0;
+      }
+    }
+
+    _checkHighWater() {
+      const buffered = this._socket.writableLength - this._pendingBytes;
+      if (buffered > this.stats.maxBuffered) {
+        this.stats.maxBuffered = buffered;
+      }
+
+      if (this._socket.destroyed) {
+        return;
+      }
+
+      if (!this._slow && buffered > this._highWaterMark) {
+        this._slow = true;
+        this._onSlow(buffered);
+      } else if (this._slow && buffered <= this._highWaterMark / 2) {
+        this._slow = false;
+        this._onRecover(buffered, this.stats);
+        this._drainBacklog();
+      }
+    }
+  }
+
+  OutboundQueue.POLICIES = POLICIES;
+
+  module.exports = OutboundQueue;
+})();
@@ -0,0 +1,217 @@
+/**
+Copyright 2017 LGS Innovations
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+**/
+
+(() => {
+  'use strict';
+
+  const EventFilter = require('./event-filter');
+
+  // How a request is assigned to one of the workers serving it:
+  //   'leastLoaded' - the worker with the fewest requests in flight,
+  //                   round-robin among ties
+  //   'roundRobin'  - each worker in turn
+  //   'shard'       - by consistent hash of the value at shardKey in the
+  //                   request params, so a key keeps reaching the same
+  //                   worker; requests without that value fall back to
+  //                   'leastLoaded'
+  const STRATEGIES = ['leastLoaded', 'roundRobin', 'shard'];
+
+  // Points per worker on the hash ring; more points even out the share
+  // of keys each worker gets
+  const RING_POINTS = 64;
+
+  /**
+   * FNV-1a with a murmur3 finalizer, 32 bit
+   */
+  function hash(str) {
+    let h = 0x811c9dc5;
+    for (let i = 0; i < str.length; i++) {
+      h ^= str.charCodeAt(i);
+      h = Math.imul(h, 0x01000193);
+    }
+    h ^= h >>> 16;
+    h = Math.imul(h, 0x85ebca6b);
+    h ^= h >>> 13;
+    h = Math.imul(h, 0xc2b2ae35);
+    h ^= h >>> 16;
+    return h >>> 0;
+  }
+
+  /**
+   * The IPC sockets serving one (request, scope). The bridge registers a
+   * single BITS request listener per group and hands each request to one
+   * worker, so handlers scale out by starting more client processes.
+   */
+  class WorkerGroup {
+    constructor(strategy, shardKey) {
+      this.strategy = STRATEGIES.includes(strategy) ? strategy : STRATEGIES[0];
+      if (this.strategy === 'shard' && typeof shardKey !== 'string') {
+        this.strategy = STRATEGIES[0];
+      }
+      this._shardPath = this.strategy === 'shard' ? shardKey.split('.') : null;
+
+      // in join order: {socket, name, registrations, inFlight, handled}
+      this._workers = [];
+      this._next = 0;
+
+      // sorted {point, worker}; each worker owns the arc ending at its
+      // points, so a join or leave only moves the keys on those arcs
+      this._ring = [];
+    }
+
+    get size() {
+      return this._workers.length;
+    }
+
+    /**
+     * Add a registration for socket; a socket that registers twice is
+     * still one worker. name places the worker on the hash ring, so a
+     * worker that reconnects under the same name gets its keys back.
+     */
+    join(socket, name) {
+      let worker = this._find(socket);
+      if (!worker) {
+        worker = {socket: socket, name: String(name), registrations: 0, inFlight: 0, handled: 0};
+        this._workers.push(worker);
+        if (this._shardPath) {
+          this._addToRing(worker);
+        }
+      }
+      worker.registrations++;
+    }
+
+    /**
+     * Drop one registration (or all of them) for socket. Returns true
+     * once socket is no longer a worker.
+     */
+    leave(socket, all) {
+      const index = this._workers.findIndex((worker) => worker.socket === socket);
+      if (index < 0) {
+        return true;
+      }
+      const worker = this._workers[index];
+      worker.registrations = all ? 0 : worker.registrations - 1;
+      if (worker.registrations > 0) {
+        return false;
+      }
+      this._workers.splice(index, 1);
+      if (this._next > index) {
+        this._next--;
+      }
+      if (this._shardPath) {
+        this._ring = this._ring.filter((entry) => entry.worker !== worker);
+      }
+      return true;
+    }
+
+    /**
+     * Choose the worker for a request with the given params, skipping
+     * closed sockets. Returns undefined when nobody can take it.
+     */
+    pick(params) {
+      if (this._shardPath) {
+        const value = EventFilter.resolve(params, this._shardPath);
+        if (value !== undefined) {
+          return this._pickShard(JSON.stringify(value));
+        }
+      }
+
+      const count = this._workers.length;
+      let chosen;
+      for (let i = 0; i < count; i++) {
+        const worker = this._workers[(this._next + i) % count];
+        if (worker.socket.destroyed) {
+          continue;
+        }
+        if (!chosen || worker.inFlight < chosen.inFlight) {
+          chosen = worker;
+        }
+        if (this.strategy === 'roundRobin' || chosen.inFlight === 0) {
+          break;
+        }
+      }
+      if (!chosen) {
+        return undefined;
+      }
+      this._next = (this._workers.indexOf(chosen) + 1) % count;
+      return chosen.socket;
+    }
+
+    /**
+     * In-flight accounting around each forwarded request
+     */
+    begin(socket) {
+      const worker = this._find(socket);
+      if (worker) {
+        worker.inFlight++;
+      }
+    }
+
+    end(socket) {
+      const worker = this._find(socket);
+      if (worker && worker.inFlight > 0) {
+        worker.inFlight--;
+        worker.handled++;
+      }
+    }
+
+    /**
+     * Owner of the first ring point at or after the key's hash; keys of a
+     * closed worker go on to the next live one
+     */
+    _pickShard(key) {
+      const ring = this._ring;
+      if (ring.length === 0) {
+        return undefined;
+      }
+
+      const h = hash(key);
+      let lo = 0;
+      let hi = ring.length;
+      while (lo < hi) {
+        const mid = (lo + hi) >>> 1;
+        if (ring[mid].point < h) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+
+      for (let i = 0; i < ring.length; i++) {
+        const worker = ring[(lo + i) % ring.length].worker;
+        if (!worker.socket.destroyed) {
+          return worker.socket;
+        }
+      }
+      return undefined;
+    }
+
+    _addToRing(worker) {
+      for (let i = 0; i < RING_POINTS; i++) {
+        this._ring.push({point: hash(worker.name + '#' + i), worker: worker});
+      }
+      this._ring.sort((a, b) => a.point - b.point);
+    }
+
+    _find(socket) {
+      return this._workers.find((worker) => worker.socket === socket);
+    }
+  }
+
+  WorkerGroup.STRATEGIES = STRATEGIES;
+
+  module.exports = WorkerGroup;
+})();
@@ -0,0 +1,192 @@
+/**
+Copyright 2017 LGS Innovations
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+**/
+
+/**
+ * Event filter check for the bits-ipc bridge.
+ *
+ * Loads index.js against a stub BITS message center, subscribes local IPC
+ * clients with sampled and unfiltered subscriptions, publishes events and
+ * counts the frames that actually cross each socket, so sampling is shown
+ * to happen before serialization. Exits 1 on a mismatch.
+ *
+ *   node test/event-filter.js
+ */
+(() => {
+  'use strict';
+
+  const assert = require('assert');
+  const net = require('net');
+
+  const EVENT = 'test#sample';
+  const EVENTS = 100;
+
+  function frame(data) {
+    return JSON.stringify({type: 'bits-ipc', data: data}) + '\f';
+  }
+
+  function stubBits() {
+    const logger = {
+      debug() {}, info() {},
+      warn: console.warn.bind(console),
+      error: console.error.bind(console)
+    };
+
+    class Messenger {
+      addEventListener() {}
+      addRequestListener() {}
+      load() { return Promise.resolve(); }
+      unload() { return Promise.resolve(); }
+    }
+
+    global.helper = {
+      LoggerFactory: { getLogger: () => logger },
+      Messenger: Messenger
+    };
+  }
+
+  class StubMessageCenter {
+    constructor() {
+      this._listeners = new Map();
+    }
+
+    addEventListener(event, scope, listener) {
+      if (!this._listeners.has(event)) {
+        this._listeners.set(event, []);
+      }
+      this._listeners.get(event).push(listener);
+      return Promise.resolve();
+    }
+
+    removeEventListener(event, listener) {
+      const listeners = this._listeners.get(event) || [];
+      const index = listeners.indexOf(listener);
+      if (index >= 0) {
+        listeners.splice(index, 1);
+      }
+      return Promise.resolve();
+    }
+
+    addRequestListener() { return Promise.resolve(); }
+    removeRequestListener() { return Promise.resolve(); }
+
+    sendEvent(event, scope, ...data) {
+      for (const listener of (this._listeners.get(event) || [])) {
+        listener(...data);
+      }
+      return Promise.resolve();
+    }
+
+    sendRequest(event) {
+      if (event === 'base#System bitsId') {
+        return Promise.resolve('test-' + process.pid);
+      }
+      return Promise.resolve(null);
+    }
+  }
+
+  function wait(ms) {
+    return new Promise((resolve) => setTimeout(resolve, ms));
+  }
+
+  /**
+   * An IPC client holding one subscription per entry of 'options',
+   * recording every event frame it receives
+   */
+  function connect(socketPath, options) {
+    return new Promise((resolve) => {
+      const client = {frames: []};
+      let buffered = '';
+      const socket = net.connect(socketPath, () => {
+        for (const option of options) {
+          socket.write(frame({type: 'addEventListener', event: EVENT, params: [{scopes: null}, option]}));
+        }
+        resolve(client);
+      });
+      socket.on('data', (data) => {
+        buffered += data;
+        let end;
+        while ((end = buffered.indexOf('\f')) >= 0) {
+          client.frames.push(JSON.parse(buffered.slice(0, end)).data);
+          buffered = buffered.slice(end + 1);
+        }
+      });
+      client.socket = socket;
+    });
+  }
+
+  function tagged(client, tag) {
+    return client.frames.filter((data) => (data.tags || []).includes(tag)).length;
+  }
+
+  function run() {
+    stubBits();
+    const ipc = require('node-ipc');
+    ipc.config.silent = true;
+
+    const bridge = require('../index.js');
+    const messageCenter = new StubMessageCenter();
+    const clients = {};
+
+    return bridge.load(messageCenter)
+    .then(() => messageCenter.sendRequest('base#System bitsId'))
+    .then((systemId) => {
+      const socketPath = ipc.config.socketRoot + 'bits.' + systemId;
+      return Promise.all([
+        connect(socketPath, [{filter: {all: [{sample: 10}]}, tag: 1}]),
+        connect(socketPath, [{filter: {all: [{sample: 10}]}, tag: 2}, null]),
+        connect(socketPath, [{filter: {all: [{sample: 2}]}, tag: 3}, {filter: {all: [{sample: 5}]}, tag: 4}])
+      ]);
+    })
+    .then((connected) => {
+      [clients.sampled, clients.mixed, clients.twoSamples] = connected;
+      return wait(200);
+    })
+    .then(() => {
+      for (let i = 0; i < EVENTS; i++) {
+        messageCenter.sendEvent(EVENT, {scopes: null}, i);
+      }
+      return wait(200);
+    })
+    .then(() => {
+      // only the sampled events are serialized for a sampled-only client
+      assert.strictEqual(clients.sampled.frames.length, EVENTS / 10, 'sampled frames on the wire');
+      assert.strictEqual(tagged(clients.sampled, 1), EVENTS / 10, 'sampled frames tagged');
+
+      // an unfiltered subscription on the same socket receives everything,
+      // and the tags still tell the sampled subscription its share
+      assert.strictEqual(clients.mixed.frames.length, EVENTS, 'mixed frames on the wire');
+      assert.strictEqual(tagged(clients.mixed, 2), EVENTS / 10, 'mixed frames tagged');
+
+      // each sample counts every event even when another entry accepted
+      // it first: events divisible by 2 or by 5
+      assert.strictEqual(clients.twoSamples.frames.length, 60, 'two samples frames on the wire');
+      assert.strictEqual(tagged(clients.twoSamples, 3), 50, 'every 2nd tagged');
+      assert.strictEqual(tagged(clients.twoSamples, 4), 20, 'every 5th tagged');
+
+      for (const name of Object.keys(clients)) {
+        console.log(name + ': ' + clients[name].frames.length + ' frames for ' + EVENTS + ' events');
+      }
+      console.log('ok');
+      process.exit(0);
+    })
+    .catch((err) => {
+      console.error(err.message || err);
+      process.exit(1);
+    });
+  }
+
+  run();
+})();